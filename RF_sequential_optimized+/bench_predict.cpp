@@ -0,0 +1,79 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include "Data.h"
+#include "RandomForest.h"
+
+using namespace std;
+
+// Inference benchmark: trains one forest, then scores the test set with every
+// prediction engine and reports the throughput, with the test features stored
+// as double and as float. All engines must agree on the same storage.
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Uso: " << argv[0] << " <file_csv> <num_alberi> [ripetizioni] [profondità]" << endl;
+        return 1;
+    }
+
+    string filename = argv[1];
+    int num_trees = stoi(argv[2]);
+    int repetitions = (argc > 3) ? stoi(argv[3]) : 20;
+    // QuickScorer only takes trees of depth <= 6 (64 leaves): a shallow forest compares all the engines
+    int max_depth = (argc > 4) ? stoi(argv[4]) : 10;
+
+    Dataset allData = load_dataset(filename);
+    Dataset trainData, testData;
+    split_dataset(allData, trainData, testData, 45, 0.8);
+
+    // The histogram engine only makes the setup faster, inference does not depend on it
+    build_histogram_bins(trainData);
+    RandomForest rf(num_trees, 1, SplitMode::Histogram);
+    rf.set_max_depth(max_depth);
+    rf.train(trainData);
+
+    struct Engine { const char* name; PredictEngine engine; };
+    vector<Engine> engines = {
+        {"scalar", PredictEngine::Scalar},
+        {simd_kernel_name(best_simd_kernel()), PredictEngine::Simd},
+    };
+    if (max_depth <= 6) engines.push_back({"quickscorer", PredictEngine::QuickScorer});
+    else cout << "quickscorer escluso: serve profondità <= 6" << endl;
+
+    Dataset testF32 = testData;
+    convert_to_float32(testF32);
+    struct Storage { const char* name; const Dataset* data; };
+    vector<Storage> storages = {{"f64", &testData}, {"f32", &testF32}};
+
+    for (const Storage& s : storages) {
+        cout << "------------------------------------------------" << endl;
+        vector<int> reference;
+        for (const Engine& e : engines) {
+            rf.set_predict_engine(e.engine);
+            vector<int> predictions = rf.predict(*s.data); // warm-up
+
+            auto start = chrono::high_resolution_clock::now();
+            for (int i = 0; i < repetitions; i++) predictions = rf.predict(*s.data);
+            auto end = chrono::high_resolution_clock::now();
+            double seconds = chrono::duration<double>(end - start).count();
+
+            if (reference.empty()) reference = predictions;
+            double rows = (double)testData.rows * repetitions;
+            cout << e.name << " (" << s.name << "): " << rows / seconds << " righe/s, "
+                 << seconds / rows * 1e6 << " us/riga"
+                 << (predictions == reference ? "" : "  (PREDIZIONI DIVERSE!)") << endl;
+        }
+
+        // Soft vote: vector walk to the leaf indices plus the sum of the leaf distributions
+        rf.set_predict_engine(PredictEngine::Simd);
+        vector<float> proba = rf.predict_proba(*s.data); // warm-up
+        auto start = chrono::high_resolution_clock::now();
+        for (int i = 0; i < repetitions; i++) proba = rf.predict_proba(*s.data);
+        auto end = chrono::high_resolution_clock::now();
+        double seconds = chrono::duration<double>(end - start).count();
+        double rows = (double)testData.rows * repetitions;
+        cout << "predict_proba (" << s.name << "): " << rows / seconds << " righe/s, "
+             << seconds / rows * 1e6 << " us/riga" << endl;
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#include <iostream>
+#include <string>
+#include "Data.h"
+
+using namespace std;
+
+// Converts a CSV dataset (last value = label) to the binary columnar format,
+// which main and bench_predict then load with a single mmap
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Uso: " << argv[0] << " <file_csv> <file_bin> [num_thread]" << endl;
+        return 1;
+    }
+
+    int num_threads = (argc > 3) ? stoi(argv[3]) : 1;
+    Dataset data = load_csv_dataset(argv[1], num_threads);
+    if (!save_binary_dataset(data, argv[2])) return 1;
+
+    cout << "Saved " << argv[2] << endl;
+    return 0;
+}
\ No newline at end of file
@@ -1,22 +1,124 @@
-#ifndef DATA_H
-#define DATA_H
-
-#include <vector>
-#include <string>
-
-struct Dataset {
-    std::vector<double> features_flat; // Unico vettore piatto (Column-Major)
-    std::vector<int> labels;
-    int rows = 0;
-    int cols = 0;
-
-    // Helper per debug o accesso singolo (lento, da non usare nei loop critici)
-    double get(int r, int c) const {
-        return features_flat[c * rows + r];
-    }
-};
-
-Dataset load_csv_dataset(const std::string& filename);
-void split_dataset(const Dataset& all_data, Dataset& train, Dataset& test, unsigned seed = 42, float train_ratio = 0.8);
-
+#ifndef DATA_H
+#define DATA_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <memory>
+#include "MappedFile.h"
+
+struct Dataset {
+    std::vector<double> features_flat; // Unico vettore piatto (Column-Major)
+    std::vector<int> labels;
+    int rows = 0;
+    int cols = 0;
+
+    // Binary datasets (load_binary_dataset) are not copied: features and labels
+    // stay in the mapped file and the two vectors above remain empty.
+    // Read through feature_data()/label_data(), which work in both cases.
+    std::shared_ptr<const MappedFile> mapping;
+    const double* mapped_features = nullptr;
+    const int* mapped_labels = nullptr;
+
+    const double* feature_data() const { return mapped_features ? mapped_features : features_flat.data(); }
+    const int* label_data() const { return mapped_labels ? mapped_labels : labels.data(); }
+
+    // Dense class ids (see encode_labels): classes are the sorted distinct labels
+    // and class_ids[r] is the position of the label of row r in classes.
+    // Filled by the loaders and carried over by split_dataset.
+    std::vector<int> classes;
+    std::vector<int> class_ids;
+    // Start of column c (all the rows of feature c are contiguous)
+    const double* column(int c) const { return feature_data() + (size_t)c * rows; }
+    // Out-of-core use: lets the OS drop the resident pages of a mapped column
+    // once it has been streamed (no effect on in-memory datasets)
+    void release_column(int c) const {
+        if (mapping && mapped_features) mapping->release(column(c), (size_t)rows * sizeof(double));
+    }
+
+    // Float32 storage (optional, see convert_to_float32): when filled it replaces
+    // features_flat with the same column-major layout and half the bytes.
+    // Thresholds stay double, so x < threshold is exact for a float x as well.
+    std::vector<float> features_f32;
+    bool is_float32() const { return !features_f32.empty(); }
+    const float* column_f32(int c) const { return features_f32.data() + (size_t)c * rows; }
+
+    // Calls f with the whole feature array (or column c) in its storage type,
+    // const double* or const float*: f is typically a generic lambda. These are
+    // the two storages the prediction kernels take.
+    template <typename F> decltype(auto) with_features(F&& f) const {
+        if (is_float32()) return f(features_f32.data());
+        return f(feature_data());
+    }
+    template <typename F> decltype(auto) with_column(int c, F&& f) const {
+        if (is_float32()) return f(column_f32(c));
+        return f(column(c));
+    }
+
+    // Histogram binning (optional, see build_histogram_bins): column-major bin codes
+    // with the same layout as features_flat, and for every column the sorted cut
+    // points. A value v falls in bin b when bin_cuts[c][b-1] <= v < bin_cuts[c][b].
+    // Codes take 1 byte (bins) up to 256 bins and 2 bytes (wide_bins) above.
+    // Only training reads the codes (SplitMode::Histogram): prediction always
+    // walks the trees on the features (double or float32), never on bin codes.
+    std::vector<uint8_t> bins;
+    std::vector<uint16_t> wide_bins;
+    std::vector<std::vector<double>> bin_cuts;
+
+    bool has_bins() const { return !bins.empty() || !wide_bins.empty(); }
+    // Calls f with the codes of column c, const uint8_t* or const uint16_t*
+    template <typename F> decltype(auto) with_bins(int c, F&& f) const {
+        if (!wide_bins.empty()) return f(wide_bins.data() + (size_t)c * rows);
+        return f(bins.data() + (size_t)c * rows);
+    }
+
+    // Helper per debug o accesso singolo (lento, da non usare nei loop critici)
+    double get(int r, int c) const {
+        return with_column(c, [r](auto col) { return (double)col[r]; });
+    }
+};
+
+// Encodes n labels as dense ids 0..K-1 in label order
+void encode_labels(const int* labels, int n, std::vector<int>& classes, std::vector<int>& class_ids);
+void encode_labels(Dataset& data);
+
+// Parses the CSV (last value of each row = label) with n_threads threads,
+// each on a newline-aligned chunk of the mapped file
+Dataset load_csv_dataset(const std::string& filename, int n_threads = 1);
+// Binary columnar format: header, then features_flat as it is (column-major
+// doubles), then the int32 labels. See Data.cpp for the layout. Float32
+// datasets are written as doubles.
+bool save_binary_dataset(const Dataset& data, const std::string& filename);
+// Maps the file: no parsing and no copy of the data
+Dataset load_binary_dataset(const std::string& filename);
+// Binary file if it starts with the binary dataset magic, CSV otherwise
+Dataset load_dataset(const std::string& filename, int n_threads = 1);
+
+// Narrows the features to float32 in place, one column at a time, and frees the
+// doubles (a mapped file is simply no longer read)
+void convert_to_float32(Dataset& data);
+
+// Quantizes every column into at most max_bins (<= 65536) bins, with 1-byte
+// codes up to 256 bins and 2-byte codes above.
+// Columns with few distinct values get one bin per value (exact thresholds),
+// the others equal-frequency bins. Columns are processed one at a time; with
+// max_sample_rows > 0 the cut points come from an evenly strided sample of
+// that many rows, so the working set stays bounded on huge datasets.
+void build_histogram_bins(Dataset& data, int max_bins = 256, int max_sample_rows = 0);
+// With copy_train_features = false the training set only gets labels and bins
+// (enough for SplitMode::Histogram): the raw features are copied for the test set only
+void split_dataset(const Dataset& all_data, Dataset& train, Dataset& test, unsigned seed = 42, float train_ratio = 0.8,
+                   bool copy_train_features = true);
+// Out-of-core split (--mem): the same shuffle as split_dataset, but nothing is
+// copied that training does not read. The training set gets labels, class ids
+// and bin codes (the cuts of build_histogram_bins over all_data, only the
+// training rows encoded), the test set stays in all_data: test_rows receives
+// its row ids, ascending, to be scored in chunks with gather_rows.
+// all_data is read one column at a time and its mapped pages are released.
+void split_dataset_binned(const Dataset& all_data, Dataset& train, std::vector<int>& test_rows, unsigned seed,
+                          float train_ratio, int max_bins = 256, int max_sample_rows = 0);
+// Copies the features and labels of rows[0, n) of data into out, releasing the
+// mapped columns it read
+void gather_rows(const Dataset& data, const int* rows, int n, Dataset& out);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,135 @@
+#ifndef FARM_H
+#define FARM_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+// Bounded blocking FIFO between the stages of a Farm. close() ends the stream:
+// pop() drains the items left and then returns false.
+template <typename T>
+class BoundedQueue {
+    std::mutex m;
+    std::condition_variable not_empty, not_full;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+
+public:
+    explicit BoundedQueue(size_t cap) : capacity(std::max<size_t>(1, cap)) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(m);
+        not_full.wait(lock, [&]() { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        lock.unlock();
+        not_empty.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(m);
+        not_empty.wait(lock, [&]() { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            closed = true;
+        }
+        not_empty.notify_all();
+    }
+};
+
+// Farm pattern, as FastFlow's ff_farm: emitter -> workers -> collector.
+//  - The emitter runs on its own thread and produces the stream of tasks until
+//    it returns false, so producing a task overlaps with the work on the others.
+//    The input queue is bounded: the emitter is never more than queue_capacity
+//    tasks ahead of the workers.
+//  - Workers take tasks on demand from the shared input queue, so a long task
+//    never holds back the ones queued after it.
+//  - The collector runs on the thread that calls run() and receives the results
+//    in completion order.
+// Workers are started on demand: a task that finds every worker busy starts a
+// new one, up to max_workers. Short streams never start idle threads.
+template <typename In, typename Out>
+class Farm {
+public:
+    using Emitter = std::function<bool(In&)>;
+    using Worker = std::function<Out(In&)>;
+    using Collector = std::function<void(Out&)>;
+
+private:
+    Emitter emitter;
+    Worker worker;
+    Collector collector;
+    int max_workers;
+
+    BoundedQueue<In> input;
+    BoundedQueue<Out> output;
+    // Only the emitter thread starts workers, run() joins them after the emitter
+    std::vector<std::thread> workers;
+    std::atomic<int> idle{0};
+    std::atomic<int> running{0};
+
+    void add_worker() {
+        running++;
+        workers.emplace_back(&Farm::worker_loop, this);
+    }
+
+    void worker_loop() {
+        In task;
+        while (true) {
+            idle++;
+            bool got = input.pop(task);
+            idle--;
+            if (!got) break;
+            output.push(worker(task));
+        }
+        // The input is closed only after the last worker was started:
+        // the last worker to leave ends the output stream
+        if (--running == 0) output.close();
+    }
+
+    void emitter_loop() {
+        In task;
+        while (emitter(task)) {
+            if (idle == 0 && (int)workers.size() < max_workers) add_worker();
+            input.push(std::move(task));
+        }
+        input.close();
+        if (workers.empty()) output.close();
+    }
+
+public:
+    Farm(Emitter e, Worker w, Collector c, int n_workers, size_t queue_capacity)
+        : emitter(std::move(e)), worker(std::move(w)), collector(std::move(c)),
+          max_workers(std::max(1, n_workers)), input(queue_capacity), output(queue_capacity) {}
+
+    Farm(const Farm&) = delete;
+    Farm& operator=(const Farm&) = delete;
+
+    // Runs the whole stream, returns when the collector has received every result
+    void run() {
+        std::thread emitter_thread(&Farm::emitter_loop, this);
+        Out result;
+        while (output.pop(result)) collector(result);
+        emitter_thread.join();
+        for (auto& w : workers) w.join();
+    }
+
+    // Workers started by the last run()
+    int num_workers() const { return (int)workers.size(); }
+};
+
+#endif
\ No newline at end of file
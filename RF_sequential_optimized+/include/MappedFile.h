@@ -0,0 +1,30 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file (POSIX mmap), unmapped on destruction
+class MappedFile {
+    const char* ptr = nullptr;
+    size_t length = 0;
+
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns false (and prints the reason) if the file cannot be mapped
+    bool open(const std::string& filename);
+
+    // Drops the resident pages of [addr, addr + len) (only whole pages inside the
+    // range). The data stays valid: it is read back from the file when touched.
+    void release(const void* addr, size_t len) const;
+
+    const char* data() const { return ptr; }
+    size_t size() const { return length; }
+};
+
+#endif
\ No newline at end of file
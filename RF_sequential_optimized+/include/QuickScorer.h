@@ -0,0 +1,50 @@
+#ifndef QUICKSCORER_H
+#define QUICKSCORER_H
+
+#include <vector>
+#include <cstdint>
+#include "Tree.h"
+#include "Data.h"
+
+// QuickScorer inference (Lucchese et al., SIGIR 2015) for the whole forest.
+// Leaves of every tree are numbered left to right and each tree keeps a bitvector
+// of the leaves still reachable. The split nodes are regrouped by feature and
+// sorted by threshold: for a row, all the nodes of feature f with
+// threshold <= x[f] go right, so their left-subtree leaves are cleared. The exit
+// leaf of a tree is then its leftmost surviving leaf. Features are visited one at
+// a time over contiguous arrays, no tree is walked node by node.
+// A bitvector is one 64-bit word, and every node stores the mask it ANDs into
+// its tree's word: only trees with at most MAX_LEAVES leaves (max_depth <= 6) are
+// supported. Deeper trees need several words per tree and per node, and there
+// the SIMD tree walk is faster, so build() refuses them.
+class QuickScorer {
+public:
+    static constexpr int MAX_LEAVES = 64;
+
+private:
+    // Split nodes of one feature, sorted by threshold (struct of arrays)
+    struct FeatureNodes {
+        std::vector<double> thresholds;
+        std::vector<int> tree;
+        std::vector<uint64_t> mask;    // all ones except the leaves of the left subtree
+    };
+
+    std::vector<FeatureNodes> features;
+    std::vector<int> tree_leaf_offset;    // first entry of every tree in leaf_class
+    std::vector<int> leaf_class;          // class index (position in classes) of every leaf
+    int n_classes = 0;
+
+    void add_tree(const FlatNode* nodes, int t, const std::vector<int>& classes);
+
+public:
+    // classes: sorted class labels, votes are indexed by position in it.
+    // False (and empty tables) when a tree has more than MAX_LEAVES leaves.
+    bool build(const std::vector<DecisionTree*>& trees, const std::vector<int>& classes);
+    bool empty() const { return tree_leaf_offset.empty(); }
+
+    // Adds the votes of all the trees for rows [row_begin, row_end) to
+    // votes[(r - row_begin) * n_classes + k]
+    void vote_rows(const Dataset& data, int row_begin, int row_end, int* votes) const;
+};
+
+#endif
\ No newline at end of file
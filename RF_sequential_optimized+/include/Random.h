@@ -0,0 +1,56 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+// Counter-based random numbers. A stream is named by a 64-bit key and its n-th
+// value is a pure function of (key, n), as in Philox/Threefry, here with the
+// splitmix64 mixer: no hidden state, so any thread, process or schedule that
+// asks for the same (key, n) gets the same number.
+//
+// Keys are derived hierarchically, e.g. for a forest:
+//   tree key = stream_key(seed, tree)       node key = stream_key(tree key, node)
+
+// splitmix64 finalizer: a bijection on 64 bits with full avalanche
+inline uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Key of the sub-stream id of stream key
+inline uint64_t stream_key(uint64_t key, uint64_t id) {
+    return splitmix64(key ^ splitmix64(id));
+}
+
+class CounterRng {
+    uint64_t key;
+    uint64_t counter;
+
+public:
+    explicit CounterRng(uint64_t stream, uint64_t first = 0) : key(stream), counter(first) {}
+
+    // Value n of the stream, independent of the position of the generator
+    uint64_t at(uint64_t n) const { return splitmix64(key + n * 0xD1B54A32D192ED03ULL); }
+
+    uint64_t next() { return at(counter++); }
+    uint32_t next32() { return (uint32_t)(next() >> 32); }
+
+    // Unbiased integer in [0, n), n > 0: Lemire's multiply-shift, which only
+    // rejects (and draws again) in the rare case the low product is below 2^32 mod n
+    uint32_t bounded(uint32_t n) {
+        uint64_t m = (uint64_t)next32() * n;
+        uint32_t low = (uint32_t)m;
+        if (low < n) {
+            uint32_t threshold = (0u - n) % n;
+            while (low < threshold) {
+                m = (uint64_t)next32() * n;
+                low = (uint32_t)m;
+            }
+        }
+        return (uint32_t)(m >> 32);
+    }
+};
+
+#endif
\ No newline at end of file
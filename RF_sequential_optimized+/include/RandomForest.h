@@ -1,20 +1,168 @@
-#ifndef RANDOMFOREST_H
-#define RANDOMFOREST_H
-
-#include "Tree.h"
-#include "Data.h"
-#include <vector>
-
-class RandomForest {
-    int num_trees;
-    std::vector<DecisionTree*> trees;
-
-public:
-    RandomForest(int n);
-    ~RandomForest();
-
-    void train(const Dataset& data);
-    void predict(const Dataset& data);
-};
-
+#ifndef RANDOMFOREST_H
+#define RANDOMFOREST_H
+
+#include "Tree.h"
+#include "Data.h"
+#include "TaskScheduler.h"
+#include "QuickScorer.h"
+#include <vector>
+#include <string>
+#include <functional>
+#include <memory>
+#include <mutex>
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+// Inference algorithm used by RandomForest::predict
+enum class PredictEngine {
+    Scalar,       // walk every flat tree one row at a time
+    Simd,         // walk every flat tree several rows at a time (best_simd_kernel)
+    QuickScorer   // bitvector scoring of all the trees, feature by feature (trees of depth <= 6)
+};
+
+// How RandomForest::train spreads the trees over the threads
+enum class TrainEngine {
+    Tasks,   // work-stealing scheduler: every tree is a task and large nodes spawn subtree tasks
+    Farm     // pipeline: an emitter thread draws the bootstraps, a farm of workers fits the trees
+};
+
+class RandomForest {
+    int num_trees;
+    int num_threads;
+    SplitMode split_mode;
+    // Bytes allowed for training (0 = unbounded), see set_memory_budget
+    size_t memory_budget = 0;
+    std::vector<DecisionTree*> trees;
+    // Class labels seen in training, sorted
+    std::vector<int> classes;
+    PredictEngine predict_engine = PredictEngine::Simd;
+    TrainEngine train_engine = TrainEngine::Tasks;
+    QuickScorer quick_scorer;
+    // Depth limit of every tree (default 10)
+    int max_depth = 10;
+    MaxFeatures max_features;
+    // Key of all the random streams of the forest (Random.h)
+    uint64_t seed = 41;
+
+    // Rows scored together by predict(): 256 rows x a few classes of votes fit in L1
+    static constexpr int PREDICT_BLOCK = 256;
+
+    // Random stream of tree i: its bootstrap is sub-stream 0, its node i sub-stream i
+    // (node ids start at 1), so the forest depends only on (seed, tree, node)
+    uint64_t tree_key(int i) const;
+    // Bootstrap sample of tree i, as a multiplicity per row
+    std::vector<int> bootstrap_counts(const Dataset& data, int i) const;
+    // Fits tree i on its bootstrap, optionally splitting its large nodes into
+    // tasks of the scheduler
+    DecisionTree* fit_tree(const Dataset& data, int i, const std::vector<int>& sample_counts, TaskScheduler* sched) const;
+    DecisionTree* build_tree(const Dataset& data, int i, TaskScheduler* sched) const;
+    // Estimated bytes of the training set and of the working memory of one tree being built
+    void training_memory(const Dataset& data, size_t& shared, size_t& per_tree) const;
+    // False (with an error) when the training set plus one tree exceeds the memory budget
+    bool fits_memory_budget(const Dataset& data) const;
+    // Rebuilds the QuickScorer tables when that engine is selected; with trees
+    // too deep for it (QuickScorer::MAX_LEAVES) predict() falls back to the tree walk
+    void build_quick_scorer();
+    // Trees that can be built concurrently within the memory budget
+    int max_live_trees(const Dataset& data) const;
+    // Builds trees [tree_begin, tree_end) into their slots of trees (train, train_mpi)
+    void build_trees(const Dataset& data, int tree_begin, int tree_end);
+    void build_trees_farm(const Dataset& data, int tree_begin, int tree_end, int max_live);
+
+    // Adds the votes of trees [tree_begin, tree_end) for rows [block_begin, block_end)
+    // to votes (one row of n_classes counters per data row)
+    void vote_block(const Dataset& data, int block_begin, int block_end, int tree_begin, int tree_end,
+                    int* leaf_labels, int* votes) const;
+    // Label with the most votes in one row of vote counters
+    int majority_class(const int* votes) const;
+    // Runs fn on contiguous ranges of whole blocks of [row_begin, row_end), one per worker
+    void for_each_row_range(int row_begin, int row_end, const std::function<void(int, int)>& fn) const;
+    // Workers of predict(): started by the first call that needs them and kept
+    // until the forest is destroyed, so a serving loop does not pay a thread
+    // start and join per batch
+    mutable std::mutex pool_mutex;
+    mutable std::unique_ptr<TaskScheduler> pool;
+    TaskScheduler& thread_pool() const;
+
+    // Trees [tree_begin, tree_end) in the model file format (see ModelIO.cpp), and
+    // back into the slots from tree_begin on: used to ship trees between processes
+    std::string serialize_trees(int tree_begin, int tree_end) const;
+    bool deserialize_trees(const char* bytes, size_t size, int tree_begin);
+
+public:
+    // n_threads <= 1 keeps the original sequential training loop.
+    // SplitMode::Histogram needs build_histogram_bins() on the training set.
+    RandomForest(int n, int n_threads = 1, SplitMode mode = SplitMode::Exact);
+    ~RandomForest();
+
+    // False when the memory budget cannot hold the training set and one tree
+    bool train(const Dataset& data);
+
+    // Compact binary model (see ModelIO.cpp). load() maps the file and the trees
+    // read their nodes from the mapping, so scoring can start without training.
+    bool save(const std::string& filename, bool float32_thresholds = false) const;
+    bool load(const std::string& filename);
+
+    // Out-of-core training. The budget covers the training set as held by the
+    // Dataset (bins, labels, class ids, features if any) plus the working memory
+    // of the trees being built, a few ints per row each (sample counts and node
+    // indices): train() builds only as many trees at once as fit, and fails if not
+    // even one does. Not counted: the trees already built and the source dataset.
+    // Use it with SplitMode::Histogram on the training set of split_dataset_binned
+    // (1 or 2 bytes per feature and 8 per row): the raw features then stay in the
+    // mapped binary file, whose pages the OS can drop, so the real limit is the
+    // binned training set plus the working memory, not the size of the file.
+    // A CSV is parsed into memory: datasets larger than RAM need csv2bin.
+    void set_memory_budget(size_t bytes) { memory_budget = bytes; }
+
+    // Key of the bootstrap and feature sampling streams (default 41): the same
+    // seed gives the same forest with any number of threads, engine or MPI ranks
+    void set_seed(uint64_t s) { seed = s; }
+
+    // Depth limit of the trees built by train() (default 10). At most 6 keeps
+    // every tree within the 64 leaves that PredictEngine::QuickScorer supports.
+    void set_max_depth(int depth) { max_depth = depth; }
+
+    // Features tried at every node of every tree (default: all of them)
+    void set_max_features(MaxFeatures mtry) { max_features = mtry; }
+
+    // Parallel training schedule (n_threads > 1); both build the same forest
+    void set_train_engine(TrainEngine engine) { train_engine = engine; }
+
+    // Can be changed before or after training
+    void set_predict_engine(PredictEngine engine);
+
+    // Columns a row must have to be scored: one more than the largest feature
+    // index used by a split (0 for a forest of leaves)
+    int num_features() const;
+
+    // Batch prediction: one label per row of data (or of rows [row_begin, row_end)).
+    // Labels are not needed, so it can score unlabeled data.
+    std::vector<int> predict(const Dataset& data) const;
+    std::vector<int> predict(const Dataset& data, int row_begin, int row_end) const;
+
+    // Soft vote: the class distributions of the leaves reached by a row, averaged
+    // over the trees. Row-major, one row of num_classes() probabilities per data
+    // row, column k for class_labels()[k]. predict() stays a hard vote.
+    std::vector<float> predict_proba(const Dataset& data) const;
+    std::vector<float> predict_proba(const Dataset& data, int row_begin, int row_end) const;
+    // Sorted class labels of the trained (or loaded) forest
+    const std::vector<int>& class_labels() const { return classes; }
+    int num_classes() const { return classes.size(); }
+
+#ifdef USE_MPI
+    // Distributed training (RandomForestMPI.cpp): every rank of comm builds a
+    // contiguous share of the trees, with the same seeds as train(), and the
+    // serialized shares are gathered so that every rank (rank 0 included) ends
+    // with the whole forest, identical to the one train() builds.
+    // Every rank must pass the same training set.
+    bool train_mpi(const Dataset& data, MPI_Comm comm);
+    // Distributed batch prediction: every rank votes with its share of the trees
+    // and the votes are summed on rank 0. Returns the labels on rank 0 and an
+    // empty vector on the other ranks.
+    std::vector<int> predict_mpi(const Dataset& data, MPI_Comm comm) const;
+#endif
+};
+
 #endif
\ No newline at end of file
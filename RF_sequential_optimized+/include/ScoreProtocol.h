@@ -0,0 +1,82 @@
+#ifndef SCOREPROTOCOL_H
+#define SCOREPROTOCOL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// Binary protocol of score_server over a Unix domain socket (native
+// little-endian). A connection carries any number of request/response pairs:
+//
+//   request:  ScoreRequest, then double features[n_rows][n_cols] (row-major:
+//             one event after the other, as a producer has them)
+//   response: ScoreResponse, then int32 labels[n_rows]
+//
+// A request with a wrong magic, with fewer columns than the model uses, or over
+// the limits below gets a response with an error status and no labels, and the
+// connection is closed. The server checks the header before allocating anything.
+// A server already serving its maximum number of connections answers a new one
+// with SCORE_SERVER_ERROR, before any request, and closes it.
+
+static const uint32_t SCORE_MAGIC = 0x51534652;   // "RFSQ"
+// Upper bounds on a single request: rows, columns and bytes of features
+static const uint32_t SCORE_MAX_ROWS = 1 << 16;
+static const uint32_t SCORE_MAX_COLS = 1 << 16;
+static const uint64_t SCORE_MAX_BYTES = 64 << 20;
+
+// Rows a request of n_cols columns may carry
+inline uint32_t score_max_rows(uint32_t n_cols) {
+    return (uint32_t)std::min<uint64_t>(SCORE_MAX_ROWS, SCORE_MAX_BYTES / (std::max<uint32_t>(1, n_cols) * sizeof(double)));
+}
+
+struct ScoreRequest {
+    uint32_t magic;
+    uint32_t n_rows;
+    uint32_t n_cols;
+    uint32_t reserved;
+};
+
+enum ScoreStatus : uint32_t {
+    SCORE_OK = 0,
+    SCORE_BAD_REQUEST = 1,
+    SCORE_SERVER_ERROR = 2   // the server could not take the request (out of memory, too many connections)
+};
+
+struct ScoreResponse {
+    uint32_t status;
+    uint32_t n_rows;
+};
+
+static_assert(sizeof(ScoreRequest) == 16, "score request layout");
+static_assert(sizeof(ScoreResponse) == 8, "score response layout");
+
+// Blocking helpers: false on error or when the peer closes the connection
+inline bool read_full(int fd, void* buf, size_t n) {
+    char* p = (char*)buf;
+    while (n > 0) {
+        ssize_t got = read(fd, p, n);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        p += got;
+        n -= got;
+    }
+    return true;
+}
+
+inline bool write_full(int fd, const void* buf, size_t n) {
+    const char* p = (const char*)buf;
+    while (n > 0) {
+        // MSG_NOSIGNAL: a peer that went away is an error, not a SIGPIPE
+        ssize_t sent = send(fd, p, n, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        p += sent;
+        n -= sent;
+    }
+    return true;
+}
+
+#endif
\ No newline at end of file
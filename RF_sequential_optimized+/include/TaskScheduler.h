@@ -0,0 +1,73 @@
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+class TaskGroup;
+
+// Small work-stealing scheduler shared by tree-level and node-level parallelism.
+// Every worker owns a deque: it pushes and pops its own tasks at the back (LIFO,
+// cache friendly for recursive splits) and steals from the front of the others.
+// Threads that wait on a TaskGroup keep executing tasks, so nested parallelism
+// never blocks a worker and never creates more threads than requested.
+class TaskScheduler {
+    struct Task {
+        std::function<void()> fn;
+        TaskGroup* group;
+    };
+
+    struct WorkQueue {
+        std::mutex m;
+        std::deque<Task> tasks;
+    };
+
+    // Slot 0 belongs to the threads outside the pool (e.g. main), slots 1..n-1 to the workers
+    std::vector<WorkQueue> queues;
+    std::vector<std::thread> workers;
+
+    std::atomic<int> queued{0};
+    std::atomic<bool> stop{false};
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+
+    int current_slot() const;
+    void push(Task task);
+    bool try_run_one(int slot);
+    void worker_loop(int slot);
+
+    friend class TaskGroup;
+
+public:
+    // n_threads counts the calling thread too: n_threads - 1 workers are started
+    explicit TaskScheduler(int n_threads);
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    int num_threads() const { return (int)queues.size(); }
+};
+
+// Set of tasks that can be waited on together (fork/join)
+class TaskGroup {
+    TaskScheduler& scheduler;
+    std::atomic<int> pending{0};
+
+    friend class TaskScheduler;
+
+public:
+    explicit TaskGroup(TaskScheduler& s) : scheduler(s) {}
+    ~TaskGroup() { wait(); }
+
+    void run(std::function<void()> fn);
+    // Returns when all the tasks of the group are done, running queued tasks meanwhile
+    void wait();
+};
+
+#endif
\ No newline at end of file
@@ -1,47 +1,184 @@
-#ifndef DECISIONTREE_H
-#define DECISIONTREE_H
-
-#include <vector>
-#include "Data.h"
-
-struct Node {
-    bool is_leaf = false;
-    int label = -1;
-    int feature_index = 0;
-    double threshold = 0.0;
-    Node* left = nullptr;
-    Node* right = nullptr;
-    ~Node();
-};
-
-class DecisionTree {
-    Node* root = nullptr;
-    int max_depth;
-    int min_size;
-
-    double gini_index(const std::vector<int>& labels, const std::vector<int>& indices);
-    
-    // get_best_split ora prende il vettore piatto e il numero di righe per calcolare gli offset
-    void get_best_split(const std::vector<double>& features_flat, int n_total_rows,
-                        const std::vector<int>& labels,
-                        const std::vector<int>& node_indices, 
-                        int& best_feat, double& best_thresh, double& best_gini, 
-                        std::vector<int>& left_idx, std::vector<int>& right_idx);
-                        
-    Node* build_recursive(const std::vector<double>& features_flat, int n_total_rows,
-                          const std::vector<int>& labels, 
-                          const std::vector<int>& node_indices, 
-                          int depth);
-
-    int predict_one(Node* node, const std::vector<double>& row);
-
-public:
-    DecisionTree(int depth = 10, int min_samples = 2);
-    ~DecisionTree();
-
-    // Fit prende l'intero dataset strutturato
-    void fit(const Dataset& train_data);
-    int predict(const std::vector<double>& row);
-};
-
+#ifndef DECISIONTREE_H
+#define DECISIONTREE_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include "Data.h"
+#include "MappedFile.h"
+#include "TaskScheduler.h"
+#include "TreeSimd.h"
+
+// How get_best_split looks for thresholds
+enum class SplitMode {
+    Exact,      // sort each feature at every node, try every distinct value
+    Histogram,  // scan the pre-binned features (Dataset::bins), no sorting
+    Presorted   // exact, but every column is sorted once per tree and then partitioned
+};
+
+// Features tried at every node (mtry): all of them (bagged trees, the
+// default), sqrt or log2 of their number, a fraction or an absolute count
+struct MaxFeatures {
+    enum Kind { All, Sqrt, Log2, Fraction, Count };
+    Kind kind = All;
+    double value = 0.0;   // the fraction or the count
+
+    // Number of features out of n_features, at least 1
+    int resolve(int n_features) const;
+    // "all", "sqrt", "log2", a fraction like "0.3" or a count like "5"
+    static bool parse(const std::string& text, MaxFeatures& out);
+};
+
+// Node used while building the tree. Nodes live in the arena of fit() and
+// are freed together with it, so they have no destructor.
+struct Node {
+    bool is_leaf = false;
+    int label = -1;
+    // Leaf: its range of node_rows, which flatten() turns into the class distribution
+    int begin = 0, end = 0;
+    int feature_index = 0;
+    double threshold = 0.0;
+    Node* left = nullptr;
+    Node* right = nullptr;
+};
+
+class NodeArena;
+
+// Node of the trained tree, 16 bytes, stored in one contiguous array in
+// breadth-first order. The two children of a node are adjacent (left first),
+// so one index is enough and a level of the tree stays in few cache lines.
+struct FlatNode {
+    int feature;        // split feature; for a leaf ~(leaf index), always negative
+    int child;          // index of the left child (right = child + 1), the label for a leaf
+    double threshold;   // rows with value < threshold go left
+};
+
+class DecisionTree {
+    // Trained tree, filled by fit() from the temporary pointer-based tree
+    std::vector<FlatNode> nodes;
+    // Nodes used for prediction: nodes.data(), or a model file mapped by load()
+    const FlatNode* node_view = nullptr;
+    int n_nodes = 0;
+    std::shared_ptr<const MappedFile> mapping;
+    // Longest root-to-leaf path of the flat tree
+    int flat_depth = 0;
+    // Class distribution of every leaf: leaf_classes floats per leaf (the weighted
+    // share of each dense class id among its training rows), row ~feature for a
+    // leaf. Owned, or in the mapped model file; none for version 1 model files.
+    std::vector<float> leaf_dist;
+    const float* leaf_dist_view = nullptr;
+    int n_leaves = 0;
+    int leaf_classes = 0;
+    int max_depth;
+    int min_size;
+    SplitMode split_mode;
+    MaxFeatures max_features;
+    // Key of the random stream of the tree (Random.h): node i samples its
+    // features from the sub-stream stream_key(random_seed, i)
+    uint64_t random_seed = 0;
+    // Nodes with at least this many rows build their subtrees as parallel tasks
+    int task_cutoff;
+    // Nodes with at least this many rows evaluate their features as parallel tasks
+    int feature_task_cutoff;
+    TaskScheduler* scheduler = nullptr;
+    // Valid during fit: where build_recursive takes its nodes from
+    NodeArena* arena = nullptr;
+    // Valid during fit: how many times each training row was drawn (0 = not in the sample)
+    const int* sample_weight = nullptr;
+    // Valid during fit: dense class id of every training row (Dataset::class_ids,
+    // or own_class_ids when the dataset has none) and the label of every id
+    const int* class_ids = nullptr;
+    const int* class_labels = nullptr;
+    int n_classes = 0;
+    std::vector<int> own_class_ids, own_classes;
+    // Valid during fit: the sampled training rows. A node owns the range
+    // [begin, end) of it, and its split partitions that range in place (left
+    // child first), so the index memory of a tree is O(rows) at any depth.
+    // partition_scratch holds the right rows while a range is partitioned.
+    std::vector<int> node_rows;
+    std::vector<int> partition_scratch;
+    // Presorted engine only, valid during fit: for every feature the training rows
+    // sorted by value (column-major like features_flat). Each node owns the same
+    // [begin, end) segment in all the lists as in node_rows.
+    std::vector<int> presorted;
+    int presort_rows = 0;
+    std::vector<char> goes_left;
+
+    double gini_index(const std::vector<int>& labels, const std::vector<int>& indices);
+    int node_weight(int begin, int end) const;
+    int majority_label(int begin, int end) const;
+    // Weighted share of every class among the rows [begin, end) of node_rows
+    void class_distribution(int begin, int end, float* out) const;
+    
+    // get_best_split ora prende il dataset piatto (column-major) e il range del nodo;
+    // if it finds a split it partitions the range and n_left is the size of the left child
+    void get_best_split(const Dataset& data, int begin, int end, uint64_t node_id,
+                        int& best_feat, double& best_thresh, double& best_gini, int& n_left);
+                        
+    void partition_presorted(int begin, int n_rows);
+
+    // node_id numbers the nodes like a heap (root 1, children 2i and 2i + 1),
+    // so it does not depend on the order in which tasks build them
+    Node* build_recursive(const Dataset& data, int begin, int end,
+                          int depth, uint64_t node_id);
+
+    // Rewrites the pointer-based tree as a breadth-first FlatNode array
+    void flatten(const Node* root);
+
+public:
+    DecisionTree(int depth = 10, int min_samples = 2, SplitMode mode = SplitMode::Exact,
+                 int node_task_cutoff = 2048, int split_task_cutoff = 8192);
+    ~DecisionTree();
+
+    // Random feature subsampling: every node draws its own features from the
+    // counter-based stream (seed, node id), so the tree does not depend on the
+    // thread schedule. seed is the key of the tree, see RandomForest::tree_key
+    void set_max_features(MaxFeatures mtry, uint64_t seed);
+
+    // Fit prende l'intero dataset strutturato.
+    // With a scheduler, large nodes are split into left/right tasks and the largest
+    // ones also search their split feature-parallel (nullptr = sequential)
+    void fit(const Dataset& train_data, TaskScheduler* sched = nullptr);
+    // Fits on a sample of the rows without copying them: row r is used
+    // sample_counts[r] times, as if it had been duplicated (a bootstrap)
+    void fit(const Dataset& train_data, const std::vector<int>& sample_counts,
+             TaskScheduler* sched = nullptr);
+    // Frees the split-search buffers of the calling thread. fit() releases those of
+    // its own thread; a thread that ran node tasks of other trees calls it when the
+    // forest is built (pool threads free theirs when they exit)
+    static void release_split_scratch();
+    // Bytes of split-search buffers one thread holds while it builds a node of data
+    static size_t split_scratch_bytes(const Dataset& data, SplitMode mode);
+    int predict(const std::vector<double>& row) const;
+    // Predicts rows [row_begin, row_end) reading the column-major features in place,
+    // several rows at a time with the vector kernels
+    void predict_rows(const Dataset& data, int row_begin, int row_end, int* out,
+                      SimdKernel kernel = best_simd_kernel()) const;
+
+    // Leaf indices (LeafValue::Index) of rows [row_begin, row_end), for leaf_distributions()
+    void predict_leaves(const Dataset& data, int row_begin, int row_end, int* out,
+                        SimdKernel kernel = best_simd_kernel()) const;
+
+    const FlatNode* flat_nodes() const { return node_view; }
+    int num_nodes() const { return n_nodes; }
+    int depth() const { return flat_depth; }
+    // num_leaves() x distribution_classes() floats, nullptr when the tree has none
+    const float* leaf_distributions() const { return leaf_dist_view; }
+    int num_leaves() const { return n_leaves; }
+    int distribution_classes() const { return leaf_classes; }
+
+    // Replaces the trained tree with a copy of the given nodes
+    void set_nodes(std::vector<FlatNode> flat, int depth);
+    // Uses nodes living in a mapped file, without copying them
+    void attach_nodes(const FlatNode* flat, int n, int depth, std::shared_ptr<const MappedFile> file);
+    // Leaf class distributions, copied or living in the file given to attach_nodes
+    // (both replace the ones of the previous tree, which set_nodes/attach_nodes drop)
+    void set_leaf_distributions(std::vector<float> dist, int leaves, int classes);
+    void attach_leaf_distributions(const float* dist, int leaves, int classes);
+
+    // Single-tree model file, same format as RandomForest::save (see ModelIO.cpp)
+    bool save(const std::string& filename, bool float32_thresholds = false) const;
+    bool load(const std::string& filename);
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef TREESIMD_H
+#define TREESIMD_H
+
+#include <cstddef>
+
+struct FlatNode;
+
+// Instruction set used to walk the flat trees during batch prediction
+enum class SimdKernel {
+    Scalar,   // one row at a time, portable
+    AVX2,     // 4 rows at a time with 256-bit gathers
+    AVX512    // 8 rows at a time with 512-bit gathers
+};
+
+// What the kernels write for the leaf a row reaches
+enum class LeafValue {
+    Label,    // its class label (FlatNode::child)
+    Index     // its index among the leaves of the tree (~FlatNode::feature)
+};
+
+// Best kernel supported by the CPU we are running on (detected once)
+SimdKernel best_simd_kernel();
+const char* simd_kernel_name(SimdKernel kernel);
+
+// All kernels predict rows [row_begin, row_end) of column-major features
+// (value of row r, feature f at features[f * n_rows + r]) and write the leaf labels
+// (or, with LeafValue::Index, the leaf indices) to out.
+// depth is the length of the longest root-to-leaf path of the tree.
+// The vector kernels need n_rows * n_features < 2^31 (32-bit gather offsets):
+// DecisionTree::predict_rows/predict_leaves fall back to the scalar walk above it.
+// The float overloads gather 4-byte values and widen them, so they compare
+// exactly like the scalar walk against the double thresholds.
+void predict_rows_scalar(const FlatNode* nodes, int depth, const double* features, size_t n_rows,
+                         int row_begin, int row_end, int* out, LeafValue value = LeafValue::Label);
+void predict_rows_avx2(const FlatNode* nodes, int depth, const double* features, size_t n_rows,
+                       int row_begin, int row_end, int* out, LeafValue value = LeafValue::Label);
+void predict_rows_avx512(const FlatNode* nodes, int depth, const double* features, size_t n_rows,
+                         int row_begin, int row_end, int* out, LeafValue value = LeafValue::Label);
+void predict_rows_scalar(const FlatNode* nodes, int depth, const float* features, size_t n_rows,
+                         int row_begin, int row_end, int* out, LeafValue value = LeafValue::Label);
+void predict_rows_avx2(const FlatNode* nodes, int depth, const float* features, size_t n_rows,
+                       int row_begin, int row_end, int* out, LeafValue value = LeafValue::Label);
+void predict_rows_avx512(const FlatNode* nodes, int depth, const float* features, size_t n_rows,
+                         int row_begin, int row_end, int* out, LeafValue value = LeafValue::Label);
+
+#endif
\ No newline at end of file
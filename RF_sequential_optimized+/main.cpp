@@ -1,62 +1,212 @@
-#include <iostream>
-#include <vector>
-#include <string>
-#include <fstream>
-#include <sstream>
-#include <chrono>
-#include <algorithm>
-#include <map>
-#include <cmath>
-#include <limits>
-#include <random>  // Per std::default_random_engine
-#include <algorithm> // Per std::shuffle
-#include "Tree.h"
-#include "Data.h"
-#include "RandomForest.h"
-
-using namespace std;
-
-
-int main(int argc, char* argv[]) {
-    // Controllo input
-    if (argc < 3) {
-        cout << "Uso: " << argv[0] << " <file_csv> <num_alberi>" << endl;
-        return 1;
-    }
-
-    string filename = argv[1];
-    int num_trees = stoi(argv[2]);
-
-// 1. Caricamento Dati
-    Dataset allData = load_csv_dataset(filename);
-    
-    // 2. Split Train/Test (Nuovo!)
-    Dataset trainData, testData;
-    int seed = 45;
-    double train_ratio = 0.8; // 80% train, 20% test
-    split_dataset(allData, trainData, testData, seed, train_ratio);
-
-    // 3. Creazione Modello
-    RandomForest rf(num_trees);
-
-    // 4. Training (SOLO sui dati di train)
-    cout << "------------------------------------------------" << endl;
-    auto start = chrono::high_resolution_clock::now();
-    
-    rf.train(trainData); 
-    
-    auto end = chrono::high_resolution_clock::now();
-    chrono::duration<double> elapsed = end - start;
-    cout << "Tempo di Training: " << elapsed.count() << " secondi." << endl;
-
-    // 5. Predizione (SOLO sui dati di test, che il modello non ha mai visto)
-    cout << "------------------------------------------------" << endl;
-    auto start_pred = chrono::high_resolution_clock::now();
-
-    rf.predict(testData); // <--- Qui passiamo testData!
-
-    auto end_pred = chrono::high_resolution_clock::now();
-    chrono::duration<double> elapsed_pred = end_pred - start_pred;
-    cout << "Tempo di Predizione: " << elapsed_pred.count() << " secondi." << endl;
-    return 0;
+#include <iostream>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <cmath>
+#include <limits>
+#include <random>  // Per std::default_random_engine
+#include <algorithm> // Per std::shuffle
+#include "Tree.h"
+#include "Data.h"
+#include "RandomForest.h"
+
+using namespace std;
+
+
+static int run(int argc, char* argv[]) {
+    // Opzioni --save=<file>, --load=<file>, --f32, --mem=<MB>, --float, --bins=<n>,
+    // --mtry=<sqrt|log2|frazione|numero>, --farm, --seed=<n>, --depth=<n> (in qualsiasi posizione), gli altri argomenti sono posizionali
+    string save_path, load_path;
+    bool float32_model = false;
+    bool float32_data = false;
+    bool farm = false;
+    uint64_t forest_seed = 41;
+    int max_bins = 256;
+    int max_depth = 10;
+    MaxFeatures max_features;
+    size_t memory_budget_mb = 0;
+    vector<string> args;
+    for (int i = 1; i < argc; i++) {
+        string a = argv[i];
+        if (a.rfind("--save=", 0) == 0) save_path = a.substr(7);
+        else if (a.rfind("--load=", 0) == 0) load_path = a.substr(7);
+        else if (a == "--f32") float32_model = true;
+        else if (a.rfind("--mem=", 0) == 0) memory_budget_mb = stoul(a.substr(6));
+        else if (a == "--float") float32_data = true;
+        else if (a == "--farm") farm = true;
+        else if (a.rfind("--seed=", 0) == 0) forest_seed = stoull(a.substr(7));
+        else if (a.rfind("--bins=", 0) == 0) max_bins = stoi(a.substr(7));
+        else if (a.rfind("--depth=", 0) == 0) max_depth = max(1, stoi(a.substr(8)));
+        else if (a.rfind("--mtry=", 0) == 0) {
+            if (!MaxFeatures::parse(a.substr(7), max_features)) {
+                cout << "--mtry: valore non valido " << a.substr(7) << endl;
+                return 1;
+            }
+        }
+        else args.push_back(a);
+    }
+
+    // Controllo input (con --load il numero di alberi viene dal modello)
+    if (args.size() < (load_path.empty() ? 2u : 1u)) {
+        cout << "Uso: " << argv[0] << " <file_csv|file_bin> <num_alberi> [num_thread] [exact|hist|presort] [simd|scalar|qs]"
+             << " [--save=<modello>] [--load=<modello>] [--f32] [--mem=<MB>] [--float] [--bins=<n>] [--mtry=<k>] [--farm] [--seed=<n>] [--depth=<n>]" << endl;
+        return 1;
+    }
+
+    string filename = args[0];
+    int num_trees = (args.size() > 1) ? stoi(args[1]) : 0;
+    // Optional: number of worker threads used to build trees (default: sequential)
+    int num_threads = (args.size() > 2) ? stoi(args[2]) : 1;
+    // Optional: split engine. "hist" bins the features once, "presort" sorts them once
+    // per tree; both avoid the per-node sort of "exact"
+    string split_arg = (args.size() > 3) ? args[3] : "exact";
+    SplitMode split_mode = SplitMode::Exact;
+    if (split_arg == "hist") split_mode = SplitMode::Histogram;
+    else if (split_arg == "presort") split_mode = SplitMode::Presorted;
+    // Optional: inference engine (default: vector tree walk)
+    string engine_arg = (args.size() > 4) ? args[4] : "simd";
+    PredictEngine engine = PredictEngine::Simd;
+    if (engine_arg == "scalar") engine = PredictEngine::Scalar;
+    else if (engine_arg == "qs") engine = PredictEngine::QuickScorer;
+    // Out-of-core (--mem): training only ever sees 1-byte bins, so it needs the histogram engine
+    bool out_of_core = memory_budget_mb > 0;
+    if (out_of_core && split_mode != SplitMode::Histogram) {
+        cout << "--mem: uso lo split a istogrammi (hist)" << endl;
+        split_mode = SplitMode::Histogram;
+    }
+
+// 1. Caricamento Dati
+    // CSV oppure dataset binario (csv2bin), riconosciuto dal contenuto del file
+    Dataset allData = load_dataset(filename, num_threads);
+    // --float: feature in float32, metà della banda per gli split e per la predizione
+    // (con --mem solo i blocchi di test: il training usa i bin)
+    if (float32_data && !out_of_core) convert_to_float32(allData);
+    if (out_of_core && !allData.mapped_features) {
+        cout << "--mem: il CSV resta tutto in memoria, per dati più grandi della RAM convertirlo con csv2bin" << endl;
+    }
+
+    // 2. Split Train/Test (Nuovo!)
+    Dataset trainData, testData;
+    // Con --mem il test set non viene copiato: sono le righe test_rows di allData
+    vector<int> test_rows;
+    int seed = 45;
+    double train_ratio = 0.8; // 80% train, 20% test
+    int data_cols = allData.cols;
+    if (out_of_core) {
+        // The (mapped) columns are read one at a time and then released: only the
+        // training rows are binned, the training set keeps bins and labels only
+        split_dataset_binned(allData, trainData, test_rows, seed, train_ratio, max_bins, 1 << 22);
+        vector<int>().swap(allData.class_ids);
+    } else {
+        split_dataset(allData, trainData, testData, seed, train_ratio);
+        if (split_mode == SplitMode::Histogram) build_histogram_bins(trainData, max_bins);
+        // I due insiemi hanno le loro copie: il dataset intero (feature, mapping) non serve più
+        allData = Dataset();
+    }
+
+    // 3. Creazione Modello
+    RandomForest rf(num_trees, num_threads, split_mode);
+    rf.set_predict_engine(engine);
+    rf.set_memory_budget(memory_budget_mb << 20);
+    rf.set_max_features(max_features);
+    // --depth: profondità massima degli alberi; fino a 6 (64 foglie) si può usare qs
+    rf.set_max_depth(max_depth);
+    // --seed: seme di bootstrap e campionamento delle feature (stessa foresta con qualsiasi numero di thread/processi)
+    rf.set_seed(forest_seed);
+    // --farm: training come pipeline emitter (bootstrap) -> farm di worker (fit) -> collector
+    if (farm) rf.set_train_engine(TrainEngine::Farm);
+
+    // Con MPI (make mpi) ogni processo costruisce una parte degli alberi e vota
+    // con la sua parte; il modello si salva e l'accuracy si calcola sul rank 0
+    bool is_root = true;
+#ifdef USE_MPI
+    int mpi_rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+    is_root = (mpi_rank == 0);
+#endif
+
+    // 4. Training (SOLO sui dati di train), oppure caricamento di un modello salvato
+    cout << "------------------------------------------------" << endl;
+    auto start = chrono::high_resolution_clock::now();
+    
+    if (load_path.empty()) {
+#ifdef USE_MPI
+        if (!rf.train_mpi(trainData, MPI_COMM_WORLD)) return 1;
+#else
+        if (!rf.train(trainData)) return 1;
+#endif
+    } else if (!rf.load(load_path)) {
+        return 1;
+    } else if (data_cols < rf.num_features()) {
+        // Un modello addestrato su un altro dataset leggerebbe colonne che non esistono
+        cerr << "Error: model " << load_path << " uses " << rf.num_features() << " features, dataset has "
+             << data_cols << endl;
+        return 1;
+    }
+    
+    auto end = chrono::high_resolution_clock::now();
+    chrono::duration<double> elapsed = end - start;
+    if (load_path.empty()) cout << "Tempo di Training: " << elapsed.count() << " secondi." << endl;
+    else cout << "Tempo di Caricamento del modello: " << elapsed.count() << " secondi." << endl;
+
+    if (!save_path.empty() && is_root) {
+        if (!rf.save(save_path, float32_model)) return 1;
+        cout << "Modello salvato in " << save_path << endl;
+    }
+
+    // 5. Predizione (SOLO sui dati di test, che il modello non ha mai visto)
+    cout << "------------------------------------------------" << endl;
+    auto start_pred = chrono::high_resolution_clock::now();
+
+    long correct = 0, scored = 0;
+    auto score = [&](const Dataset& test) {
+#ifdef USE_MPI
+        vector<int> predictions = rf.predict_mpi(test, MPI_COMM_WORLD);
+#else
+        vector<int> predictions = rf.predict(test); // <--- Qui passiamo testData!
+#endif
+        if (!is_root) return;
+        for (int i = 0; i < test.rows; i++) if (predictions[i] == test.label_data()[i]) correct++;
+        scored += test.rows;
+    };
+    if (out_of_core) {
+        // --mem: le righe di test si copiano dal dataset (mappato) un blocco alla volta
+        const int chunk_rows = 1 << 16;
+        Dataset chunk;
+        for (size_t first = 0; first < test_rows.size(); first += chunk_rows) {
+            int n = min<size_t>(chunk_rows, test_rows.size() - first);
+            gather_rows(allData, &test_rows[first], n, chunk);
+            if (float32_data) convert_to_float32(chunk);
+            score(chunk);
+        }
+    } else {
+        score(testData);
+    }
+
+    auto end_pred = chrono::high_resolution_clock::now();
+    chrono::duration<double> elapsed_pred = end_pred - start_pred;
+
+    if (!is_root) return 0;
+    cout << "Accuracy: " << (double)correct / max(1L, scored) * 100.0 << "%" << endl;
+    cout << "Tempo di Predizione: " << elapsed_pred.count() << " secondi." << endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+#ifdef USE_MPI
+    MPI_Init(&argc, &argv);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    // Stampa solo il rank 0, gli altri processi lavorano in silenzio (gli errori vanno su cerr)
+    if (rank != 0) cout.setstate(ios::failbit);
+    int status = run(argc, argv);
+    MPI_Finalize();
+    return status;
+#else
+    return run(argc, argv);
+#endif
 }
\ No newline at end of file
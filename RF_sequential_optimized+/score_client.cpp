@@ -0,0 +1,118 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "Data.h"
+#include "ScoreProtocol.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// Load generator for score_server: every connection sends its requests back to
+// back (closed loop), taking consecutive rows of a dataset, and measures the
+// round trip of each one. The concurrency is the number of connections, so it
+// also drives the micro-batching of the server.
+
+// Percentile p (0..100) of the samples, which are reordered
+static double percentile(vector<double>& samples, double p) {
+    if (samples.empty()) return 0.0;
+    size_t k = min(samples.size() - 1, (size_t)(p / 100.0 * samples.size()));
+    nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return samples[k];
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        cout << "Uso: " << argv[0] << " <socket> <file_csv|file_bin> [connessioni] [richieste_per_connessione]"
+             << " [righe_per_richiesta]" << endl;
+        return 1;
+    }
+    string socket_path = argv[1];
+    int n_connections = (argc > 3) ? max(1, stoi(argv[3])) : 4;
+    int n_requests = (argc > 4) ? max(1, stoi(argv[4])) : 10000;
+    int rows_per_request = (argc > 5) ? max(1, stoi(argv[5])) : 1;
+
+    Dataset data = load_dataset(argv[2]);
+    if (data.rows == 0) return 1;
+    rows_per_request = min(rows_per_request, min(data.rows, (int)score_max_rows(data.cols)));
+
+    // Requests carry rows, the dataset has columns: transpose it once
+    vector<double> row_major((size_t)data.rows * data.cols);
+    for (int c = 0; c < data.cols; c++) {
+        data.with_column(c, [&](auto col) {
+            for (int r = 0; r < data.rows; r++) row_major[(size_t)r * data.cols + c] = col[r];
+        });
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    mutex result_mutex;
+    vector<double> latency_us;
+    long correct = 0, scored = 0, failed = 0;
+
+    auto run_connection = [&](int id) {
+        vector<double> local_latency;
+        local_latency.reserve(n_requests);
+        long local_correct = 0, local_scored = 0;
+        bool ok = true;
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            cerr << "Error: unable to connect to " << socket_path << ": " << strerror(errno) << endl;
+            ok = false;
+        }
+
+        vector<int> labels(rows_per_request);
+        int n_starts = data.rows - rows_per_request + 1;
+        for (int k = 0; k < n_requests && ok; k++) {
+            int first = (int)(((long)id * n_requests + k) * rows_per_request % n_starts);
+            ScoreRequest request = {SCORE_MAGIC, (uint32_t)rows_per_request, (uint32_t)data.cols, 0};
+            ScoreResponse response;
+
+            auto start = Clock::now();
+            ok = write_full(fd, &request, sizeof(request)) &&
+                 write_full(fd, &row_major[(size_t)first * data.cols], (size_t)rows_per_request * data.cols * sizeof(double)) &&
+                 read_full(fd, &response, sizeof(response)) && response.status == SCORE_OK &&
+                 response.n_rows == (uint32_t)rows_per_request &&
+                 read_full(fd, labels.data(), rows_per_request * sizeof(int));
+            if (!ok) break;
+            local_latency.push_back(chrono::duration<double, micro>(Clock::now() - start).count());
+
+            for (int r = 0; r < rows_per_request; r++) local_correct += labels[r] == data.label_data()[first + r];
+            local_scored += rows_per_request;
+        }
+        if (fd >= 0) close(fd);
+
+        lock_guard<mutex> lock(result_mutex);
+        latency_us.insert(latency_us.end(), local_latency.begin(), local_latency.end());
+        correct += local_correct;
+        scored += local_scored;
+        if (!ok) failed++;
+    };
+
+    cout << n_connections << " connessioni x " << n_requests << " richieste da " << rows_per_request
+         << " righe su " << socket_path << endl;
+    auto start = Clock::now();
+    vector<thread> connections;
+    for (int i = 0; i < n_connections; i++) connections.emplace_back(run_connection, i);
+    for (auto& t : connections) t.join();
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+    if (failed > 0) cerr << "Error: " << failed << " connessioni interrotte" << endl;
+    cout << "Richieste: " << latency_us.size() << " in " << seconds << " s (" << latency_us.size() / seconds
+         << "/s), " << scored / seconds << " righe/s" << endl;
+    cout << "Latenza p50 " << percentile(latency_us, 50) << " us, p99 " << percentile(latency_us, 99)
+         << " us, p99.9 " << percentile(latency_us, 99.9) << " us, max " << percentile(latency_us, 100) << " us" << endl;
+    if (scored > 0) cout << "Accordo con le etichette del dataset: " << (double)correct / scored * 100.0 << "%" << endl;
+    return failed > 0 ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,357 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <cmath>
+#include <new>
+#include <system_error>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "Data.h"
+#include "RandomForest.h"
+#include "ScoreProtocol.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// Resident scoring daemon: maps a saved model once (RandomForest::load) and
+// scores the requests of its clients over a Unix domain socket, see
+// ScoreProtocol.h. Every connection has its own thread, which only does I/O
+// (at most max_connections of them: further clients are turned away);
+// a single scorer thread merges the pending requests into micro-batches and
+// runs the batch prediction on them.
+//
+// Micro-batching is adaptive: a batch is whatever is queued when the scorer is
+// free, so an isolated request is scored at once. Only when the previous batch
+// held several requests (the server is under load) the scorer waits up to
+// max_wait_us for more rows, trading a few microseconds for larger batches.
+
+static atomic<bool> stop_requested(false);
+static void on_signal(int) { stop_requested = true; }
+
+struct PendingRequest {
+    vector<double> rows;   // n_rows x n_cols, row-major, as received
+    int n_rows = 0;
+    int n_cols = 0;
+    vector<int> labels;
+    Clock::time_point received;
+    promise<void> done;
+};
+
+// Log-bucketed latency histogram: PER_OCTAVE buckets per power of two of
+// microseconds (under 5% relative error) from 1 us to about 2^32 us. Its size is
+// fixed, however many requests the daemon serves.
+struct LatencyHistogram {
+    static constexpr int PER_OCTAVE = 16;
+    static constexpr int BUCKETS = 1 + 32 * PER_OCTAVE;
+    long counts[BUCKETS] = {};
+    long total = 0;
+    double max_us = 0.0;
+
+    // Bucket 0 holds [0, 1) us, bucket b > 0 holds [2^((b-1)/PER_OCTAVE), 2^(b/PER_OCTAVE)) us
+    void add(double us) {
+        int b = (us < 1.0) ? 0 : min(BUCKETS - 1, 1 + (int)(log2(us) * PER_OCTAVE));
+        counts[b]++;
+        total++;
+        max_us = max(max_us, us);
+    }
+
+    // Upper edge of the bucket holding percentile p (0..100), never above the maximum
+    double percentile(double p) const {
+        if (total == 0) return 0.0;
+        long rank = min(total - 1, (long)(p / 100.0 * total));
+        long seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += counts[b];
+            if (seen > rank) return min(max_us, exp2((double)b / PER_OCTAVE));
+        }
+        return max_us;
+    }
+};
+
+// Latencies (request received -> response sent) and batch sizes
+struct ServerStats {
+    mutex m;
+    LatencyHistogram window_latency, total_latency;
+    long window_rows = 0, window_batches = 0;
+    long total_rows = 0, total_batches = 0;
+
+    void add_batch(int n_rows) {
+        lock_guard<mutex> lock(m);
+        window_batches++;
+        total_batches++;
+        window_rows += n_rows;
+        total_rows += n_rows;
+    }
+
+    void add_request(double latency_us) {
+        lock_guard<mutex> lock(m);
+        window_latency.add(latency_us);
+        total_latency.add(latency_us);
+    }
+
+    static void print(const char* what, double seconds, long rows, long batches, const LatencyHistogram& latency) {
+        long requests = latency.total;
+        if (requests == 0) return;
+        cout << what << ": " << requests << " richieste (" << requests / seconds << "/s), "
+             << rows / seconds << " righe/s, batch medio " << (double)rows / max(1L, batches) << " righe, latenza p50 "
+             << latency.percentile(50) << " us, p99 " << latency.percentile(99) << " us, max "
+             << latency.max_us << " us" << endl;
+    }
+
+    void report_window(double seconds) {
+        lock_guard<mutex> lock(m);
+        print("Ultimo intervallo", seconds, window_rows, window_batches, window_latency);
+        window_latency = LatencyHistogram();
+        window_rows = window_batches = 0;
+    }
+
+    void report_total(double seconds) {
+        lock_guard<mutex> lock(m);
+        print("Totale", seconds, total_rows, total_batches, total_latency);
+    }
+};
+
+class ScoringServer {
+    RandomForest& rf;
+    int n_features;
+    int max_batch_rows;
+    int max_wait_us;
+
+    mutex m;
+    condition_variable cv;
+    deque<PendingRequest*> queue;
+    int queued_rows = 0;
+
+public:
+    ServerStats stats;
+    // Connections being served, each by its own thread
+    atomic<int> active_connections{0};
+
+    ScoringServer(RandomForest& forest, int batch_rows, int wait_us)
+        : rf(forest), n_features(forest.num_features()), max_batch_rows(batch_rows), max_wait_us(wait_us) {}
+
+    void submit(PendingRequest* request) {
+        {
+            lock_guard<mutex> lock(m);
+            queue.push_back(request);
+            queued_rows += request->n_rows;
+        }
+        cv.notify_one();
+    }
+
+    void scorer_loop() {
+        bool under_load = false;
+        vector<PendingRequest*> batch;
+        Dataset rows;
+        while (true) {
+            batch.clear();
+            {
+                unique_lock<mutex> lock(m);
+                cv.wait(lock, [&]() { return !queue.empty(); });
+                if (under_load && max_wait_us > 0) {
+                    cv.wait_for(lock, chrono::microseconds(max_wait_us),
+                                [&]() { return queued_rows >= max_batch_rows; });
+                }
+                // Whole requests only; a request larger than the batch is scored alone
+                int batch_rows = 0;
+                while (!queue.empty() && (batch.empty() || batch_rows + queue.front()->n_rows <= max_batch_rows)) {
+                    batch.push_back(queue.front());
+                    batch_rows += queue.front()->n_rows;
+                    queued_rows -= queue.front()->n_rows;
+                    queue.pop_front();
+                }
+            }
+            under_load = batch.size() > 1;
+            score(batch, rows);
+        }
+    }
+
+    // Transposes the rows of the batch into one column-major dataset (the
+    // layout predict() reads) and hands every request its labels
+    void score(const vector<PendingRequest*>& batch, Dataset& rows) {
+        int total = 0;
+        for (auto request : batch) total += request->n_rows;
+        rows.rows = total;
+        rows.cols = n_features;
+        rows.features_flat.resize((size_t)total * n_features);
+
+        int offset = 0;
+        for (auto request : batch) {
+            for (int r = 0; r < request->n_rows; r++) {
+                const double* row = &request->rows[(size_t)r * request->n_cols];
+                for (int c = 0; c < n_features; c++) rows.features_flat[(size_t)c * total + offset + r] = row[c];
+            }
+            offset += request->n_rows;
+        }
+
+        vector<int> labels = rf.predict(rows);
+        stats.add_batch(total);
+
+        offset = 0;
+        for (auto request : batch) {
+            request->labels.assign(labels.begin() + offset, labels.begin() + offset + request->n_rows);
+            offset += request->n_rows;
+            request->done.set_value();
+        }
+    }
+
+    // One client: reads a request, waits for its batch, writes the response
+    void serve_connection(int fd) {
+        ScoreRequest header;
+        while (read_full(fd, &header, sizeof(header))) {
+            // The sizes come from the client: checked before they size any buffer
+            if (header.magic != SCORE_MAGIC || header.n_cols > SCORE_MAX_COLS || (int)header.n_cols < n_features ||
+                header.n_rows > score_max_rows(header.n_cols)) {
+                ScoreResponse error = {SCORE_BAD_REQUEST, 0};
+                write_full(fd, &error, sizeof(error));
+                break;
+            }
+
+            PendingRequest request;
+            request.n_rows = header.n_rows;
+            request.n_cols = header.n_cols;
+            try {
+                request.rows.resize((size_t)header.n_rows * header.n_cols);
+            } catch (const bad_alloc&) {
+                // Only this client is turned away, the daemon keeps serving the others
+                ScoreResponse error = {SCORE_SERVER_ERROR, 0};
+                write_full(fd, &error, sizeof(error));
+                break;
+            }
+            if (!read_full(fd, request.rows.data(), request.rows.size() * sizeof(double))) break;
+            request.received = Clock::now();
+
+            if (request.n_rows > 0) {
+                future<void> scored = request.done.get_future();
+                submit(&request);
+                scored.wait();
+            }
+
+            ScoreResponse response = {SCORE_OK, header.n_rows};
+            if (!write_full(fd, &response, sizeof(response)) ||
+                !write_full(fd, request.labels.data(), request.labels.size() * sizeof(int))) break;
+            stats.add_request(chrono::duration<double, micro>(Clock::now() - request.received).count());
+        }
+        close(fd);
+        active_connections--;
+    }
+
+    // Starts the thread of a new client, or turns it away with SCORE_SERVER_ERROR
+    // once max_connections are being served
+    void accept_connection(int fd, int max_connections) {
+        if (++active_connections <= max_connections) {
+            try {
+                thread(&ScoringServer::serve_connection, this, fd).detach();
+                return;
+            } catch (const system_error&) {
+                // No thread for this client: refused like one over the limit
+            }
+        }
+        active_connections--;
+        ScoreResponse error = {SCORE_SERVER_ERROR, 0};
+        write_full(fd, &error, sizeof(error));
+        close(fd);
+    }
+};
+
+int main(int argc, char* argv[]) {
+    // Opzioni --max-batch=<righe>, --max-wait=<us>, --report=<secondi>, --threads=<n>,
+    // --max-conn=<n> (in qualsiasi posizione)
+    int max_batch_rows = 1024;
+    int n_threads = 1;
+    int max_connections = 256;
+    int max_wait_us = 50;
+    double report_seconds = 5.0;
+    vector<string> args;
+    for (int i = 1; i < argc; i++) {
+        string a = argv[i];
+        if (a.rfind("--max-batch=", 0) == 0) max_batch_rows = max(1, stoi(a.substr(12)));
+        else if (a.rfind("--max-wait=", 0) == 0) max_wait_us = max(0, stoi(a.substr(11)));
+        else if (a.rfind("--report=", 0) == 0) report_seconds = stod(a.substr(9));
+        else if (a.rfind("--threads=", 0) == 0) n_threads = max(1, stoi(a.substr(10)));
+        else if (a.rfind("--max-conn=", 0) == 0) max_connections = max(1, stoi(a.substr(11)));
+        else args.push_back(a);
+    }
+    if (args.size() < 2) {
+        cout << "Uso: " << argv[0] << " <modello> <socket> [simd|scalar|qs]"
+             << " [--max-batch=<righe>] [--max-wait=<us>] [--report=<secondi>] [--threads=<n>]"
+             << " [--max-conn=<n>]" << endl;
+        return 1;
+    }
+    string model_path = args[0];
+    string socket_path = args[1];
+    string engine_arg = (args.size() > 2) ? args[2] : "simd";
+    PredictEngine engine = PredictEngine::Simd;
+    if (engine_arg == "scalar") engine = PredictEngine::Scalar;
+    else if (engine_arg == "qs") engine = PredictEngine::QuickScorer;
+
+    // --threads: workers that score the blocks of a batch; the forest keeps them
+    // alive between batches, so a batch never starts threads
+    RandomForest rf(0, n_threads);
+    if (!rf.load(model_path)) return 1;
+    rf.set_predict_engine(engine);
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        cerr << "Error: socket path too long: " << socket_path << endl;
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path.c_str());
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 128) < 0) {
+        cerr << "Error: unable to listen on " << socket_path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Lives until exit(): connection threads may still be waiting on it
+    ScoringServer* server = new ScoringServer(rf, max_batch_rows, max_wait_us);
+    thread(&ScoringServer::scorer_loop, server).detach();
+
+    cout << "Modello " << model_path << " (" << rf.num_features() << " feature) in ascolto su " << socket_path
+         << ", batch max " << max_batch_rows << " righe, attesa max " << max_wait_us << " us, max "
+         << max_connections << " connessioni" << endl;
+
+    // The main thread accepts the connections and prints the statistics; poll
+    // wakes it up regularly to check for a signal
+    auto start = Clock::now();
+    auto last_report = start;
+    while (!stop_requested) {
+        pollfd pfd = {listen_fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, 200);
+        if (ready > 0) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0) server->accept_connection(fd, max_connections);
+        }
+        auto now = Clock::now();
+        double since_report = chrono::duration<double>(now - last_report).count();
+        if (report_seconds > 0 && since_report >= report_seconds) {
+            server->stats.report_window(since_report);
+            last_report = now;
+        }
+    }
+
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    server->stats.report_total(chrono::duration<double>(Clock::now() - start).count());
+    // The detached threads may be blocked on a client: leave without joining them
+    exit(0);
+}
\ No newline at end of file
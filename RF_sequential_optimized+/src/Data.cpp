@@ -1,122 +1,527 @@
-#include "Data.h"
-#include <vector>
-#include <string>
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <random>
-#include <algorithm>
-#include <numeric>
-
-using namespace std;
-
-Dataset load_csv_dataset(const string& filename) {
-    Dataset data;
-    ifstream file(filename);
-    string line;
-
-    if (!file.is_open()) {
-        cerr << "Error: Unable to open file " << filename << endl;
-        exit(1);
-    }
-
-    // Temporary storage in row-major format
-    vector<vector<double>> temp_rows;
-    
-    while (getline(file, line)) {
-        stringstream ss(line);
-        string val_str;
-        vector<double> row_features;
-        
-        while (getline(ss, val_str, ',')) {
-            row_features.push_back(stod(val_str));
-        }
-        
-        // If a row have at least one feature the last value is the label
-        if (!row_features.empty()) {
-            // take last value as label
-            int label = (int)row_features.back();
-
-            // remove label from features
-            row_features.pop_back();
-            
-            // Store the row
-            temp_rows.push_back(row_features);
-            // Store the label
-            data.labels.push_back(label);
-        }
-    }
-    
-    data.rows = temp_rows.size();
-
-    // if any row exists, infer number of columns from the first row
-    if (data.rows > 0) data.cols = temp_rows[0].size();
-
-    // Now convert to column-major format
-    // [Col0_R0, Col0_R1, ..., Col1_R0, Col1_R1, ...]
-    data.features_flat.resize(data.rows * data.cols);
-    
-    // Convert from row-major to column-major
-    for (int c = 0; c < data.cols; c++) {
-        for (int r = 0; r < data.rows; r++) {
-            // column c row r goes to index c * rows + r in flat array
-            data.features_flat[c * data.rows + r] = temp_rows[r][c];
-        }
-    }
-    
-    cout << "Loaded dataset: " << data.rows << " rows, " << data.cols << " columns." << endl;
-    return data;
-}
-
-// split_dataset divides the dataset into training and test sets
-void split_dataset(const Dataset& all_data, Dataset& train, Dataset& test, unsigned seed, float train_ratio) {
-    int total_rows = all_data.rows;
-    int n_cols = all_data.cols;
-    int train_rows = (int)(total_rows * train_ratio);
-    int test_rows = total_rows - train_rows;
-
-    train.rows = train_rows; train.cols = n_cols;
-    test.rows = test_rows; test.cols = n_cols;
-    
-    // memory allocation
-    train.features_flat.resize(train_rows * n_cols);
-    train.labels.resize(train_rows);
-    test.features_flat.resize(test_rows * n_cols);
-    test.labels.resize(test_rows);
-
-    // Create shuffled indices for splitting
-    vector<int> indices(total_rows);
-    iota(indices.begin(), indices.end(), 0);
-    shuffle(indices.begin(), indices.end(), default_random_engine(seed));
-
-    // Copy labels
-    // the data in cell at index "i" of train becomes the data in cell at index "indices[i]" of all_data, this allows shuffling,
-    // e.g. if "i" = 0 indices[i] = 5, then train.labels[0] = all_data.labels[5]
-    for(int i=0; i<total_rows; i++) {
-        if(i < train_rows) train.labels[i] = all_data.labels[indices[i]];
-        // else part goes to test set
-        else test.labels[i - train_rows] = all_data.labels[indices[i]];
-    }
-
-    // Copy features column by column (faster for sequential writing)
-    for (int c = 0; c < n_cols; c++) {
-        // since we are working with column-major, calculate offsets
-        int src_offset = c * total_rows;
-        int train_offset = c * train_rows;
-        int test_offset = c * test_rows;
-
-        // Copy data for this column
-        for (int i = 0; i < total_rows; i++) {
-            int original_idx = indices[i];
-            double val = all_data.features_flat[src_offset + original_idx];
-            
-            if (i < train_rows) {
-                train.features_flat[train_offset + i] = val;
-            } else {
-                test.features_flat[test_offset + (i - train_rows)] = val;
-            }
-        }
-    }
-
-    cout << "Split completed: " << train.rows << " training, " << test.rows << " test." << endl;
+#include "Data.h"
+#include "MappedFile.h"
+#include "TaskScheduler.h"
+#include "Random.h"
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstring>
+#include <climits>
+#include <fstream>
+#include <charconv>
+#include <algorithm>
+#include <numeric>
+
+using namespace std;
+
+// Skips spaces and tabs (stod did it, from_chars does not)
+static inline const char* skip_blanks(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+// Parses one number starting at p (optionally signed with '+') and returns the
+// position after it, or nullptr if there is no number
+static inline const char* parse_double(const char* p, const char* end, double& value) {
+    p = skip_blanks(p, end);
+    if (p < end && *p == '+') p++;
+    auto [next, ec] = from_chars(p, end, value);
+    if (ec != errc()) return nullptr;
+    return skip_blanks(next, end);
+}
+
+// A line is empty if it only has blanks or '\r'
+static inline bool is_blank_line(const char* p, const char* line_end) {
+    for (; p < line_end; p++) if (*p != ' ' && *p != '\t' && *p != '\r') return false;
+    return true;
+}
+
+// Number of non-blank lines in [p, end); p must be at the start of a line
+static int count_rows(const char* p, const char* end) {
+    int rows = 0;
+    while (p < end) {
+        const char* line_end = (const char*)memchr(p, '\n', end - p);
+        if (!line_end) line_end = end;
+        if (!is_blank_line(p, line_end)) rows++;
+        p = line_end + 1;
+    }
+    return rows;
+}
+
+// Parses the lines of [p, end) as rows first_row, first_row + 1, ... of data,
+// straight into the column-major layout [Col0_R0, Col0_R1, ..., Col1_R0, ...]
+static void parse_rows(const char* p, const char* end, int first_row, Dataset& data, const string& filename) {
+    int r = first_row;
+    while (p < end) {
+        const char* line_end = (const char*)memchr(p, '\n', end - p);
+        if (!line_end) line_end = end;
+        if (is_blank_line(p, line_end)) { p = line_end + 1; continue; }
+
+        for (int c = 0; c <= data.cols; c++) {
+            double value;
+            p = parse_double(p, line_end, value);
+            bool last = (c == data.cols);
+            if (!p || (!last && (p >= line_end || *p != ','))) {
+                cerr << "Error: malformed value at row " << r + 1 << ", column " << c + 1 << " of " << filename << endl;
+                exit(1);
+            }
+            if (last) data.labels[r] = (int)value;
+            else {
+                data.features_flat[(size_t)c * data.rows + r] = value;
+                p++; // skip ','
+            }
+        }
+        if (!is_blank_line(p, line_end)) {
+            cerr << "Error: row " << r + 1 << " of " << filename << " has more than " << data.cols + 1 << " values" << endl;
+            exit(1);
+        }
+        r++;
+        p = line_end + 1;
+    }
+}
+
+Dataset load_csv_dataset(const string& filename, int n_threads) {
+    Dataset data;
+    MappedFile file;
+
+    if (!file.open(filename)) {
+        exit(1);
+    }
+
+    const char* begin = file.data();
+    const char* end = begin + file.size();
+
+    // The number of columns comes from the first non-blank row, the last value of each row is the label
+    const char* first = begin;
+    while (first < end) {
+        const char* line_end = (const char*)memchr(first, '\n', end - first);
+        if (!line_end) line_end = end;
+        if (!is_blank_line(first, line_end)) {
+            data.cols = count(first, line_end, ',');
+            break;
+        }
+        first = line_end + 1;
+    }
+
+    // Split the file in chunks that start right after a newline
+    int n_chunks = max(1, n_threads);
+    vector<const char*> bounds(n_chunks + 1, end);
+    bounds[0] = begin;
+    for (int k = 1; k < n_chunks; k++) {
+        const char* p = max(bounds[k-1], begin + file.size() * k / n_chunks);
+        const char* nl = (p < end) ? (const char*)memchr(p, '\n', end - p) : nullptr;
+        bounds[k] = nl ? nl + 1 : end;
+    }
+
+    // Every chunk is counted and then parsed independently; the row offsets of the
+    // chunks (prefix sum of their counts) keep the original row order
+    vector<int> chunk_rows(n_chunks), first_row(n_chunks);
+    auto for_each_chunk = [&](auto&& fn) {
+        if (n_chunks == 1) { fn(0); return; }
+        TaskScheduler scheduler(n_chunks);
+        TaskGroup group(scheduler);
+        for (int k = 0; k < n_chunks; k++) group.run([&, k]() { fn(k); });
+        group.wait();
+    };
+
+    for_each_chunk([&](int k) { chunk_rows[k] = count_rows(bounds[k], bounds[k+1]); });
+    for (int k = 0; k < n_chunks; k++) {
+        first_row[k] = data.rows;
+        data.rows += chunk_rows[k];
+    }
+
+    if (data.rows == 0 || data.cols < 1) {
+        cerr << "Error: no data rows in " << filename << endl;
+        exit(1);
+    }
+
+    // features_flat and labels are allocated once and filled in place
+    data.features_flat.resize((size_t)data.rows * data.cols);
+    data.labels.resize(data.rows);
+
+    for_each_chunk([&](int k) { parse_rows(bounds[k], bounds[k+1], first_row[k], data, filename); });
+    
+    encode_labels(data);
+    cout << "Loaded dataset: " << data.rows << " rows, " << data.cols << " columns." << endl;
+    return data;
+}
+
+// Binary columnar dataset (native little-endian):
+//   BinaryDatasetHeader (64 bytes)
+//   double features[cols][rows]   at features_offset, exactly like features_flat
+//   int32  labels[rows]           at labels_offset
+// Both offsets are multiples of 64, so a mapped file can be used as it is.
+static const char DATASET_MAGIC[4] = {'R', 'F', 'D', 'S'};
+static const uint32_t DATASET_VERSION = 1;
+
+struct BinaryDatasetHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t rows;
+    uint64_t cols;
+    uint32_t feature_bytes;   // 8 = float64
+    uint32_t label_bytes;     // 4 = int32
+    uint64_t features_offset;
+    uint64_t labels_offset;
+    uint8_t reserved[16];
+};
+static_assert(sizeof(BinaryDatasetHeader) == 64, "binary dataset header layout");
+
+bool save_binary_dataset(const Dataset& data, const string& filename) {
+    ofstream out(filename, ios::binary);
+    if (!out.is_open()) {
+        cerr << "Error: Unable to create file " << filename << endl;
+        return false;
+    }
+
+    uint64_t feature_bytes = (uint64_t)data.rows * data.cols * sizeof(double);
+    BinaryDatasetHeader header = {};
+    memcpy(header.magic, DATASET_MAGIC, 4);
+    header.version = DATASET_VERSION;
+    header.rows = data.rows;
+    header.cols = data.cols;
+    header.feature_bytes = sizeof(double);
+    header.label_bytes = sizeof(int32_t);
+    header.features_offset = sizeof(BinaryDatasetHeader);
+    header.labels_offset = (header.features_offset + feature_bytes + 63) & ~(uint64_t)63;
+
+    static const char padding[64] = {};
+    out.write((const char*)&header, sizeof(header));
+    if (data.is_float32()) {
+        // The format only has doubles: widen one column at a time
+        vector<double> col(data.rows);
+        for (int c = 0; c < data.cols; c++) {
+            const float* src = data.column_f32(c);
+            copy(src, src + data.rows, col.begin());
+            out.write((const char*)col.data(), (size_t)data.rows * sizeof(double));
+        }
+    } else {
+        out.write((const char*)data.feature_data(), feature_bytes);
+    }
+    out.write(padding, header.labels_offset - header.features_offset - feature_bytes);
+    out.write((const char*)data.label_data(), (size_t)data.rows * sizeof(int32_t));
+
+    if (!out.good()) {
+        cerr << "Error: Unable to write file " << filename << endl;
+        return false;
+    }
+    return true;
+}
+
+Dataset load_binary_dataset(const string& filename) {
+    Dataset data;
+    auto file = make_shared<MappedFile>();
+    if (!file->open(filename)) exit(1);
+
+    const BinaryDatasetHeader* header = (const BinaryDatasetHeader*)file->data();
+    if (file->size() < sizeof(BinaryDatasetHeader) || memcmp(header->magic, DATASET_MAGIC, 4) != 0) {
+        cerr << "Error: " << filename << " is not a binary dataset" << endl;
+        exit(1);
+    }
+    if (header->version != DATASET_VERSION || header->feature_bytes != sizeof(double) || header->label_bytes != sizeof(int32_t)) {
+        cerr << "Error: unsupported binary dataset format in " << filename << endl;
+        exit(1);
+    }
+    // rows and cols become ints; with both below 2^31 their product fits in 64 bits
+    if (header->rows < 1 || header->rows > INT_MAX || header->cols < 1 || header->cols > INT_MAX ||
+        header->features_offset % 64 != 0 || header->labels_offset % 64 != 0) {
+        cerr << "Error: corrupted binary dataset header in " << filename << endl;
+        exit(1);
+    }
+    uint64_t size = file->size();
+    if (header->features_offset > size || header->rows * header->cols > (size - header->features_offset) / sizeof(double) ||
+        header->labels_offset > size || header->rows > (size - header->labels_offset) / sizeof(int32_t)) {
+        cerr << "Error: truncated binary dataset " << filename << endl;
+        exit(1);
+    }
+
+    data.rows = header->rows;
+    data.cols = header->cols;
+    data.mapped_features = (const double*)(file->data() + header->features_offset);
+    data.mapped_labels = (const int*)(file->data() + header->labels_offset);
+    data.mapping = file;
+
+    encode_labels(data);
+    cout << "Mapped dataset: " << data.rows << " rows, " << data.cols << " columns." << endl;
+    return data;
+}
+
+Dataset load_dataset(const string& filename, int n_threads) {
+    char magic[4] = {};
+    ifstream probe(filename, ios::binary);
+    probe.read(magic, 4);
+    if (probe.gcount() == 4 && memcmp(magic, DATASET_MAGIC, 4) == 0) return load_binary_dataset(filename);
+    return load_csv_dataset(filename, n_threads);
+}
+
+void encode_labels(const int* labels, int n, vector<int>& classes, vector<int>& class_ids) {
+    classes.assign(labels, labels + n);
+    sort(classes.begin(), classes.end());
+    classes.erase(unique(classes.begin(), classes.end()), classes.end());
+    class_ids.resize(n);
+    for (int r = 0; r < n; r++) {
+        class_ids[r] = lower_bound(classes.begin(), classes.end(), labels[r]) - classes.begin();
+    }
+}
+
+void encode_labels(Dataset& data) {
+    encode_labels(data.label_data(), data.rows, data.classes, data.class_ids);
+}
+
+void convert_to_float32(Dataset& data) {
+    if (data.is_float32()) return;
+    data.features_f32.resize((size_t)data.rows * data.cols);
+    for (int c = 0; c < data.cols; c++) {
+        const double* src = data.column(c);
+        float* dst = &data.features_f32[(size_t)c * data.rows];
+        for (int r = 0; r < data.rows; r++) dst[r] = (float)src[r];
+        data.release_column(c);
+    }
+    vector<double>().swap(data.features_flat);
+    data.mapped_features = nullptr;
+}
+
+// Bin code of every row of a column: number of cuts <= value
+template <typename T, typename B>
+static void assign_bins(const T* col_ptr, int n_rows, const vector<double>& cuts, B* bin_ptr) {
+    for (int r = 0; r < n_rows; r++) {
+        bin_ptr[r] = (B)(upper_bound(cuts.begin(), cuts.end(), (double)col_ptr[r]) - cuts.begin());
+    }
+}
+
+// Cut points of column c: one bin per value when there are few, equal-frequency
+// bins otherwise, from n_sample rows evenly strided over the column
+static void column_bin_cuts(const Dataset& data, int c, int max_bins, int n_sample, vector<double>& sorted_vals,
+                            vector<double>& cuts) {
+    sorted_vals.resize(n_sample);
+    data.with_column(c, [&](auto col_ptr) {
+        if (n_sample == data.rows) sorted_vals.assign(col_ptr, col_ptr + data.rows);
+        else for (int k = 0; k < n_sample; k++) sorted_vals[k] = col_ptr[(size_t)k * data.rows / n_sample];
+    });
+    sort(sorted_vals.begin(), sorted_vals.end());
+    vector<double> distinct = sorted_vals;
+    distinct.erase(unique(distinct.begin(), distinct.end()), distinct.end());
+
+    cuts.clear();
+    if ((int)distinct.size() <= max_bins) {
+        // One bin per value: cuts are the same midpoints the exact engine would use
+        for (size_t k = 1; k < distinct.size(); k++) cuts.push_back((distinct[k-1] + distinct[k]) / 2.0);
+    } else {
+        // Equal-frequency bins, cut at the midpoint between two distinct values
+        for (int b = 1; b < max_bins; b++) {
+            double v = sorted_vals[(size_t)b * n_sample / max_bins];
+            size_t k = lower_bound(distinct.begin(), distinct.end(), v) - distinct.begin();
+            if (k == 0) continue;
+            double cut = (distinct[k-1] + distinct[k]) / 2.0;
+            if (cuts.empty() || cut > cuts.back()) cuts.push_back(cut);
+        }
+    }
+}
+
+// build_histogram_bins quantizes every column once, so the histogram split engine
+// can work on 1 or 2-byte codes instead of sorting doubles at every node
+void build_histogram_bins(Dataset& data, int max_bins, int max_sample_rows) {
+    max_bins = max(2, min(max_bins, 65536));
+    bool wide = max_bins > 256;
+    if (wide) {
+        data.wide_bins.resize((size_t)data.rows * data.cols);
+        vector<uint8_t>().swap(data.bins);
+    } else {
+        data.bins.resize((size_t)data.rows * data.cols);
+        vector<uint16_t>().swap(data.wide_bins);
+    }
+    data.bin_cuts.assign(data.cols, vector<double>());
+
+    int n_sample = (max_sample_rows > 0) ? min(data.rows, max_sample_rows) : data.rows;
+    vector<double> sorted_vals;
+    for (int c = 0; c < data.cols; c++) {
+        vector<double>& cuts = data.bin_cuts[c];
+        column_bin_cuts(data, c, max_bins, n_sample, sorted_vals, cuts);
+
+        data.with_column(c, [&](auto col_ptr) {
+            if (wide) assign_bins(col_ptr, data.rows, cuts, &data.wide_bins[(size_t)c * data.rows]);
+            else assign_bins(col_ptr, data.rows, cuts, &data.bins[(size_t)c * data.rows]);
+        });
+        data.release_column(c);
+    }
+
+    cout << "Binned dataset: at most " << max_bins << " bins per column." << endl;
+}
+
+// Scatters one column (features or bin codes) of all_data to the shuffled train
+// and test columns; train_dst may be null when the training set does not need it
+template <typename T>
+static void split_column(const T* src, const vector<int>& indices, int train_rows, T* train_dst, T* test_dst) {
+    int total_rows = indices.size();
+    for (int i = 0; i < total_rows; i++) {
+        if (i < train_rows) {
+            if (train_dst) train_dst[i] = src[indices[i]];
+        } else {
+            test_dst[i - train_rows] = src[indices[i]];
+        }
+    }
+}
+
+// Shuffled row ids for splitting (Fisher-Yates on the counter-based stream of seed)
+static vector<int> shuffled_rows(int total_rows, unsigned seed) {
+    vector<int> indices(total_rows);
+    iota(indices.begin(), indices.end(), 0);
+    CounterRng rng(stream_key(seed, 0));
+    for (int i = total_rows - 1; i > 0; i--) swap(indices[i], indices[rng.bounded(i + 1)]);
+    return indices;
+}
+
+// split_dataset divides the dataset into training and test sets
+void split_dataset(const Dataset& all_data, Dataset& train, Dataset& test, unsigned seed, float train_ratio,
+                   bool copy_train_features) {
+    int total_rows = all_data.rows;
+    int n_cols = all_data.cols;
+    int train_rows = (int)(total_rows * train_ratio);
+    int test_rows = total_rows - train_rows;
+
+    train.rows = train_rows; train.cols = n_cols;
+    test.rows = test_rows; test.cols = n_cols;
+    
+    // memory allocation (float32 datasets stay float32)
+    bool f32 = all_data.is_float32();
+    if (copy_train_features) {
+        if (f32) train.features_f32.resize((size_t)train_rows * n_cols);
+        else train.features_flat.resize((size_t)train_rows * n_cols);
+    }
+    train.labels.resize(train_rows);
+    if (f32) test.features_f32.resize((size_t)test_rows * n_cols);
+    else test.features_flat.resize((size_t)test_rows * n_cols);
+    test.labels.resize(test_rows);
+
+    vector<int> indices = shuffled_rows(total_rows, seed);
+
+    // Copy labels
+    // the data in cell at index "i" of train becomes the data in cell at index "indices[i]" of all_data, this allows shuffling,
+    // e.g. if "i" = 0 indices[i] = 5, then train.labels[0] = all_data.labels[5]
+    for(int i=0; i<total_rows; i++) {
+        if(i < train_rows) train.labels[i] = all_data.label_data()[indices[i]];
+        // else part goes to test set
+        else test.labels[i - train_rows] = all_data.label_data()[indices[i]];
+    }
+
+    // Class ids keep the encoding of the whole dataset, even if a class is
+    // missing from one of the two sets
+    if (!all_data.class_ids.empty()) {
+        train.classes = test.classes = all_data.classes;
+        train.class_ids.resize(train_rows);
+        test.class_ids.resize(test_rows);
+        split_column(all_data.class_ids.data(), indices, train_rows, train.class_ids.data(), test.class_ids.data());
+    }
+
+    // Copy features column by column (faster for sequential writing)
+    for (int c = 0; c < n_cols; c++) {
+        // since we are working with column-major, calculate offsets
+        size_t train_offset = (size_t)c * train_rows;
+        size_t test_offset = (size_t)c * test_rows;
+
+        // Copy data for this column
+        if (f32) {
+            split_column(all_data.column_f32(c), indices, train_rows,
+                         copy_train_features ? &train.features_f32[train_offset] : nullptr,
+                         &test.features_f32[test_offset]);
+        } else {
+            split_column(all_data.column(c), indices, train_rows,
+                         copy_train_features ? &train.features_flat[train_offset] : nullptr,
+                         &test.features_flat[test_offset]);
+        }
+        all_data.release_column(c);
+    }
+
+    // Bin codes follow their rows, the cut points are the same
+    if (all_data.has_bins()) {
+        bool wide = !all_data.wide_bins.empty();
+        if (wide) {
+            train.wide_bins.resize((size_t)train_rows * n_cols);
+            test.wide_bins.resize((size_t)test_rows * n_cols);
+        } else {
+            train.bins.resize((size_t)train_rows * n_cols);
+            test.bins.resize((size_t)test_rows * n_cols);
+        }
+        train.bin_cuts = test.bin_cuts = all_data.bin_cuts;
+        for (int c = 0; c < n_cols; c++) {
+            if (wide) {
+                split_column(&all_data.wide_bins[(size_t)c * total_rows], indices, train_rows,
+                             &train.wide_bins[(size_t)c * train_rows], &test.wide_bins[(size_t)c * test_rows]);
+            } else {
+                split_column(&all_data.bins[(size_t)c * total_rows], indices, train_rows,
+                             &train.bins[(size_t)c * train_rows], &test.bins[(size_t)c * test_rows]);
+            }
+        }
+    }
+
+    cout << "Split completed: " << train.rows << " training, " << test.rows << " test." << endl;
+}
+
+void split_dataset_binned(const Dataset& all_data, Dataset& train, vector<int>& test_rows, unsigned seed,
+                          float train_ratio, int max_bins, int max_sample_rows) {
+    int total_rows = all_data.rows;
+    int n_cols = all_data.cols;
+    int train_rows = (int)(total_rows * train_ratio);
+    vector<int> indices = shuffled_rows(total_rows, seed);
+
+    train.rows = train_rows;
+    train.cols = n_cols;
+    train.labels.resize(train_rows);
+    for (int i = 0; i < train_rows; i++) train.labels[i] = all_data.label_data()[indices[i]];
+    if (!all_data.class_ids.empty()) {
+        train.classes = all_data.classes;
+        train.class_ids.resize(train_rows);
+        for (int i = 0; i < train_rows; i++) train.class_ids[i] = all_data.class_ids[indices[i]];
+    } else {
+        encode_labels(train);
+    }
+
+    // Same cuts and codes as build_histogram_bins on the whole dataset followed by
+    // split_dataset, but only the training rows are ever encoded
+    max_bins = max(2, min(max_bins, 65536));
+    bool wide = max_bins > 256;
+    if (wide) train.wide_bins.resize((size_t)train_rows * n_cols);
+    else train.bins.resize((size_t)train_rows * n_cols);
+    train.bin_cuts.assign(n_cols, vector<double>());
+
+    int n_sample = (max_sample_rows > 0) ? min(total_rows, max_sample_rows) : total_rows;
+    vector<double> sorted_vals;
+    for (int c = 0; c < n_cols; c++) {
+        const vector<double>& cuts = train.bin_cuts[c];
+        column_bin_cuts(all_data, c, max_bins, n_sample, sorted_vals, train.bin_cuts[c]);
+        all_data.with_column(c, [&](auto col_ptr) {
+            for (int i = 0; i < train_rows; i++) {
+                int code = upper_bound(cuts.begin(), cuts.end(), (double)col_ptr[indices[i]]) - cuts.begin();
+                if (wide) train.wide_bins[(size_t)c * train_rows + i] = code;
+                else train.bins[(size_t)c * train_rows + i] = code;
+            }
+        });
+        all_data.release_column(c);
+    }
+
+    // Ascending, so a chunk of test rows reads every column forward
+    test_rows.assign(indices.begin() + train_rows, indices.end());
+    sort(test_rows.begin(), test_rows.end());
+
+    cout << "Binned training set: at most " << max_bins << " bins per column." << endl;
+    cout << "Split completed: " << train.rows << " training, " << test_rows.size() << " test (not copied)." << endl;
+}
+
+void gather_rows(const Dataset& data, const int* rows, int n, Dataset& out) {
+    out = Dataset();
+    out.rows = n;
+    out.cols = data.cols;
+    out.labels.resize(n);
+    for (int i = 0; i < n; i++) out.labels[i] = data.label_data()[rows[i]];
+    if (data.is_float32()) out.features_f32.resize((size_t)n * data.cols);
+    else out.features_flat.resize((size_t)n * data.cols);
+    for (int c = 0; c < data.cols; c++) {
+        data.with_column(c, [&](auto col_ptr) {
+            for (int i = 0; i < n; i++) {
+                if (data.is_float32()) out.features_f32[(size_t)c * n + i] = col_ptr[rows[i]];
+                else out.features_flat[(size_t)c * n + i] = col_ptr[rows[i]];
+            }
+        });
+        data.release_column(c);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,47 @@
+#include "MappedFile.h"
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdint>
+
+using namespace std;
+
+MappedFile::~MappedFile() {
+    if (ptr) munmap((void*)ptr, length);
+}
+
+void MappedFile::release(const void* addr, size_t len) const {
+    if (!ptr || len == 0) return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)addr + page - 1) & ~(uintptr_t)(page - 1);
+    uintptr_t last = ((uintptr_t)addr + len) & ~(uintptr_t)(page - 1);
+    if (last > first) madvise((void*)first, last - first, MADV_DONTNEED);
+}
+
+bool MappedFile::open(const string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error: Unable to open file " << filename << endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        cerr << "Error: Unable to read size of file " << filename << endl;
+        close(fd);
+        return false;
+    }
+
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid after close
+    if (p == MAP_FAILED) {
+        cerr << "Error: Unable to map file " << filename << endl;
+        return false;
+    }
+
+    ptr = (const char*)p;
+    length = st.st_size;
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,319 @@
+#include "RandomForest.h"
+#include "Tree.h"
+#include "MappedFile.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+// Binary model file (native little-endian), laid out so that a mapped file can
+// be used directly:
+//
+//   ModelHeader
+//   int32 classes[num_classes]
+//   TreeEntry trees[num_trees]
+//   for every tree, each array starting at a 16-byte aligned offset:
+//     nodes:
+//       threshold_bytes == 8: FlatNode {int32 feature, int32 child, double threshold}
+//       threshold_bytes == 4: FlatNode32 {int32 feature, int32 child, float threshold}
+//     leaf class distributions: float[n_leaves][leaf_classes]
+//
+// Version 1 files have 16-byte tree entries (offset, n_nodes, depth) and no
+// distributions: they still load, and predict_proba counts their votes instead.
+//
+// Double-threshold models are loaded with zero parsing: the trees point into the
+// mapping, distributions included. Float32 models are half the size on disk but are widened on load, and
+// their thresholds are rounded to float, so a prediction can change for values
+// that fall between the original threshold and its rounding.
+
+static const char MODEL_MAGIC[4] = {'R', 'F', 'M', 'D'};
+static const uint32_t MODEL_VERSION = 2;
+
+struct ModelHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_trees;
+    uint32_t num_classes;
+    uint32_t threshold_bytes;
+    uint32_t reserved;
+};
+
+struct TreeEntry {
+    uint64_t offset;      // from the start of the file
+    uint32_t n_nodes;
+    uint32_t depth;
+    uint64_t leaf_offset; // 0 when the tree has no leaf distributions
+    uint32_t n_leaves;
+    uint32_t leaf_classes;
+};
+
+struct TreeEntryV1 {
+    uint64_t offset;
+    uint32_t n_nodes;
+    uint32_t depth;
+};
+
+struct FlatNode32 {
+    int32_t feature;
+    int32_t child;
+    float threshold;
+};
+
+static_assert(sizeof(ModelHeader) == 24, "model header layout");
+static_assert(sizeof(TreeEntry) == 32, "model tree entry layout");
+static_assert(sizeof(TreeEntryV1) == 16, "model v1 tree entry layout");
+static_assert(sizeof(FlatNode32) == 12, "model float32 node layout");
+
+static uint64_t align16(uint64_t offset) { return (offset + 15) & ~(uint64_t)15; }
+
+// Offsets are relative to the first byte written to out
+static void write_model(ostream& out, const vector<const DecisionTree*>& trees,
+                        const vector<int>& classes, bool float32_thresholds) {
+    ModelHeader header;
+    memcpy(header.magic, MODEL_MAGIC, 4);
+    header.version = MODEL_VERSION;
+    header.num_trees = trees.size();
+    header.num_classes = classes.size();
+    header.threshold_bytes = float32_thresholds ? 4 : 8;
+    header.reserved = 0;
+
+    // Offsets of the node arrays
+    size_t node_bytes = float32_thresholds ? sizeof(FlatNode32) : sizeof(FlatNode);
+    uint64_t offset = sizeof(ModelHeader) + classes.size() * sizeof(int32_t) + trees.size() * sizeof(TreeEntry);
+    vector<TreeEntry> entries(trees.size());
+    for (size_t t = 0; t < trees.size(); t++) {
+        const DecisionTree* tree = trees[t];
+        offset = align16(offset);
+        entries[t] = {offset, (uint32_t)tree->num_nodes(), (uint32_t)tree->depth(), 0, 0, 0};
+        offset += tree->num_nodes() * node_bytes;
+        if (tree->leaf_distributions()) {
+            offset = align16(offset);
+            entries[t].leaf_offset = offset;
+            entries[t].n_leaves = tree->num_leaves();
+            entries[t].leaf_classes = tree->distribution_classes();
+            offset += (uint64_t)tree->num_leaves() * tree->distribution_classes() * sizeof(float);
+        }
+    }
+
+    out.write((const char*)&header, sizeof(header));
+    for (int c : classes) {
+        int32_t v = c;
+        out.write((const char*)&v, sizeof(v));
+    }
+    out.write((const char*)entries.data(), entries.size() * sizeof(TreeEntry));
+
+    static const char padding[16] = {};
+    for (size_t t = 0; t < trees.size(); t++) {
+        out.write(padding, entries[t].offset - (uint64_t)out.tellp());
+        const FlatNode* nodes = trees[t]->flat_nodes();
+        if (float32_thresholds) {
+            vector<FlatNode32> narrow(trees[t]->num_nodes());
+            for (size_t i = 0; i < narrow.size(); i++) {
+                narrow[i] = {nodes[i].feature, nodes[i].child, (float)nodes[i].threshold};
+            }
+            out.write((const char*)narrow.data(), narrow.size() * sizeof(FlatNode32));
+        } else {
+            out.write((const char*)nodes, trees[t]->num_nodes() * sizeof(FlatNode));
+        }
+        if (entries[t].leaf_offset != 0) {
+            out.write(padding, entries[t].leaf_offset - (uint64_t)out.tellp());
+            out.write((const char*)trees[t]->leaf_distributions(),
+                      (size_t)entries[t].n_leaves * entries[t].leaf_classes * sizeof(float));
+        }
+    }
+}
+
+static bool write_model(const string& filename, const vector<const DecisionTree*>& trees,
+                        const vector<int>& classes, bool float32_thresholds) {
+    ofstream out(filename, ios::binary);
+    if (!out.is_open()) {
+        cerr << "Error: Unable to create file " << filename << endl;
+        return false;
+    }
+    write_model(out, trees, classes, float32_thresholds);
+    if (!out.good()) {
+        cerr << "Error: Unable to write file " << filename << endl;
+        return false;
+    }
+    return true;
+}
+
+// Checks the nodes of a tree before any kernel walks them: split nodes point
+// forward to a child pair inside the array (so every walk ends), leaves carry an
+// index below the number of leaves (returned in n_leaves) and one of the
+// forest's labels, and depth is the length of the longest root-to-leaf path,
+// which the vector kernels rely on.
+template <typename Node>
+static bool valid_nodes(const Node* nodes, uint32_t n_nodes, uint32_t depth, const vector<int>& classes,
+                        uint32_t& n_leaves) {
+    if (n_nodes == 0) return false;
+    n_leaves = 0;
+    for (uint32_t i = 0; i < n_nodes; i++) n_leaves += nodes[i].feature < 0;
+
+    vector<uint32_t> node_depth(n_nodes, 0);
+    uint32_t max_depth = 0;
+    for (uint32_t i = 0; i < n_nodes; i++) {
+        const Node& n = nodes[i];
+        if (n.feature < 0) {
+            if ((uint32_t)~n.feature >= n_leaves) return false;
+            if (!classes.empty() && !binary_search(classes.begin(), classes.end(), n.child)) return false;
+            max_depth = max(max_depth, node_depth[i]);
+        } else {
+            if (n.child <= (int64_t)i || (int64_t)n.child + 1 >= n_nodes) return false;
+            for (int k = 0; k < 2; k++) node_depth[n.child + k] = max(node_depth[n.child + k], node_depth[i] + 1);
+        }
+    }
+    return depth == max_depth;
+}
+
+// Parses a model held in [base, base + size). With a mapped file the trees
+// attach to it (float32 models are always copied); without one (a buffer
+// received from another process) the nodes are copied.
+static bool read_model(const char* base, size_t size, const string& filename, shared_ptr<const MappedFile> file,
+                       vector<DecisionTree*>& trees, vector<int>& classes) {
+    const ModelHeader* header = (const ModelHeader*)base;
+    if (size < sizeof(ModelHeader) || memcmp(header->magic, MODEL_MAGIC, 4) != 0) {
+        cerr << "Error: " << filename << " is not a model file" << endl;
+        return false;
+    }
+    if (header->version < 1 || header->version > MODEL_VERSION ||
+        (header->threshold_bytes != 4 && header->threshold_bytes != 8)) {
+        cerr << "Error: unsupported model version " << header->version << " in " << filename << endl;
+        return false;
+    }
+
+    size_t entry_bytes = (header->version == 1) ? sizeof(TreeEntryV1) : sizeof(TreeEntry);
+    size_t table_end = sizeof(ModelHeader) + header->num_classes * sizeof(int32_t) + header->num_trees * entry_bytes;
+    if (size < table_end) {
+        cerr << "Error: truncated model file " << filename << endl;
+        return false;
+    }
+
+    const int32_t* class_ptr = (const int32_t*)(base + sizeof(ModelHeader));
+    classes.assign(class_ptr, class_ptr + header->num_classes);
+
+    const char* entry_table = (const char*)(class_ptr + header->num_classes);
+    size_t node_bytes = (header->threshold_bytes == 4) ? sizeof(FlatNode32) : sizeof(FlatNode);
+    for (uint32_t t = 0; t < header->num_trees; t++) {
+        TreeEntry e = {};
+        if (header->version == 1) {
+            const TreeEntryV1& v1 = ((const TreeEntryV1*)entry_table)[t];
+            e.offset = v1.offset;
+            e.n_nodes = v1.n_nodes;
+            e.depth = v1.depth;
+        } else {
+            e = ((const TreeEntry*)entry_table)[t];
+        }
+        size_t leaf_bytes = (size_t)e.n_leaves * e.leaf_classes * sizeof(float);
+        bool valid = e.offset % 16 == 0 && e.offset <= size && e.n_nodes * node_bytes <= size - e.offset &&
+                     (e.leaf_offset == 0 || (e.leaf_offset % 16 == 0 && e.leaf_offset <= size &&
+                                             leaf_bytes <= size - e.leaf_offset));
+        uint32_t n_leaves = 0;
+        if (valid) {
+            valid = (header->threshold_bytes == 4)
+                        ? valid_nodes((const FlatNode32*)(base + e.offset), e.n_nodes, e.depth, classes, n_leaves)
+                        : valid_nodes((const FlatNode*)(base + e.offset), e.n_nodes, e.depth, classes, n_leaves);
+        }
+        // The distributions are indexed by the leaf indices just checked
+        if (e.leaf_offset != 0 && e.n_leaves != n_leaves) valid = false;
+        if (!valid) {
+            cerr << "Error: corrupted tree " << t << " in " << filename << endl;
+            for (auto tree : trees) delete tree;
+            trees.clear();
+            return false;
+        }
+
+        DecisionTree* tree = new DecisionTree();
+        if (header->threshold_bytes == 8 && file) {
+            tree->attach_nodes((const FlatNode*)(base + e.offset), e.n_nodes, e.depth, file);
+        } else if (header->threshold_bytes == 8) {
+            const FlatNode* nodes = (const FlatNode*)(base + e.offset);
+            tree->set_nodes(vector<FlatNode>(nodes, nodes + e.n_nodes), e.depth);
+        } else {
+            const FlatNode32* narrow = (const FlatNode32*)(base + e.offset);
+            vector<FlatNode> wide(e.n_nodes);
+            for (uint32_t i = 0; i < e.n_nodes; i++) wide[i] = {narrow[i].feature, narrow[i].child, narrow[i].threshold};
+            tree->set_nodes(std::move(wide), e.depth);
+        }
+        if (e.leaf_offset != 0) {
+            const float* dist = (const float*)(base + e.leaf_offset);
+            // Attached only next to attached nodes: the tree then keeps the mapping alive
+            if (header->threshold_bytes == 8 && file) tree->attach_leaf_distributions(dist, e.n_leaves, e.leaf_classes);
+            else tree->set_leaf_distributions(vector<float>(dist, dist + leaf_bytes / sizeof(float)), e.n_leaves, e.leaf_classes);
+        }
+        trees.push_back(tree);
+    }
+    return true;
+}
+
+// Maps the file and attaches (or, for float32 files, copies) every tree
+static bool read_model(const string& filename, vector<DecisionTree*>& trees, vector<int>& classes) {
+    auto file = make_shared<MappedFile>();
+    if (!file->open(filename)) return false;
+    return read_model(file->data(), file->size(), filename, file, trees, classes);
+}
+
+bool DecisionTree::save(const string& filename, bool float32_thresholds) const {
+    return write_model(filename, {this}, {}, float32_thresholds);
+}
+
+bool DecisionTree::load(const string& filename) {
+    vector<DecisionTree*> loaded;
+    vector<int> classes;
+    if (!read_model(filename, loaded, classes)) return false;
+    if (loaded.size() != 1) {
+        cerr << "Error: " << filename << " contains " << loaded.size() << " trees, expected 1" << endl;
+        for (auto tree : loaded) delete tree;
+        return false;
+    }
+    // Take over the nodes and distributions (or the mapping) of the loaded tree
+    DecisionTree* tree = loaded[0];
+    if (tree->nodes.empty()) attach_nodes(tree->node_view, tree->n_nodes, tree->flat_depth, tree->mapping);
+    else set_nodes(std::move(tree->nodes), tree->flat_depth);
+    if (!tree->leaf_dist.empty()) set_leaf_distributions(std::move(tree->leaf_dist), tree->n_leaves, tree->leaf_classes);
+    else if (tree->leaf_dist_view) attach_leaf_distributions(tree->leaf_dist_view, tree->n_leaves, tree->leaf_classes);
+    delete tree;
+    return true;
+}
+
+bool RandomForest::save(const string& filename, bool float32_thresholds) const {
+    vector<const DecisionTree*> view(trees.begin(), trees.end());
+    return write_model(filename, view, classes, float32_thresholds);
+}
+
+bool RandomForest::load(const string& filename) {
+    vector<DecisionTree*> loaded;
+    vector<int> loaded_classes;
+    if (!read_model(filename, loaded, loaded_classes)) return false;
+
+    for (auto t : trees) delete t;
+    trees = std::move(loaded);
+    classes = std::move(loaded_classes);
+    num_trees = trees.size();
+    build_quick_scorer();
+    return true;
+}
+
+string RandomForest::serialize_trees(int tree_begin, int tree_end) const {
+    vector<const DecisionTree*> view(trees.begin() + tree_begin, trees.begin() + tree_end);
+    ostringstream out(ios::binary);
+    write_model(out, view, classes, false);
+    return out.str();
+}
+
+bool RandomForest::deserialize_trees(const char* bytes, size_t size, int tree_begin) {
+    vector<DecisionTree*> loaded;
+    vector<int> loaded_classes;
+    if (!read_model(bytes, size, "serialized trees", nullptr, loaded, loaded_classes)) return false;
+    if (tree_begin + loaded.size() > trees.size()) trees.resize(tree_begin + loaded.size(), nullptr);
+    for (size_t k = 0; k < loaded.size(); k++) {
+        delete trees[tree_begin + k];
+        trees[tree_begin + k] = loaded[k];
+    }
+    classes = std::move(loaded_classes);
+    return true;
+}
\ No newline at end of file
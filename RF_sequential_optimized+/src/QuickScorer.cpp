@@ -0,0 +1,128 @@
+#include "QuickScorer.h"
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+using namespace std;
+
+void QuickScorer::add_tree(const FlatNode* nodes, int t, const vector<int>& classes) {
+    // In-order visit: leaves get consecutive ids from left to right, and every
+    // split node clears the id range of its left subtree in its mask
+    int n_leaves = 0;
+    auto visit = [&](auto& self, int i) -> void {
+        const FlatNode& n = nodes[i];
+        if (n.feature < 0) {
+            leaf_class.push_back(lower_bound(classes.begin(), classes.end(), n.child) - classes.begin());
+            n_leaves++;
+            return;
+        }
+        int left_begin = n_leaves;
+        self(self, n.child);
+        int left_end = n_leaves;
+
+        // Bits [left_begin, left_end) cleared; left_end <= 64 since the tree has at most 64 leaves
+        uint64_t left_bits = (left_end - left_begin == 64) ? ~0ULL : (((1ULL << (left_end - left_begin)) - 1) << left_begin);
+        FeatureNodes& fn = features[n.feature];
+        fn.thresholds.push_back(n.threshold);
+        fn.tree.push_back(t);
+        fn.mask.push_back(~left_bits);
+
+        self(self, n.child + 1);
+    };
+    visit(visit, 0);
+}
+
+bool QuickScorer::build(const vector<DecisionTree*>& trees, const vector<int>& classes) {
+    n_classes = classes.size();
+    features.clear();
+    tree_leaf_offset.clear();
+    leaf_class.clear();
+
+    int n_features = 0;
+    for (auto tree : trees) {
+        const FlatNode* nodes = tree->flat_nodes();
+        int n_leaves = 0;
+        for (int i = 0; i < tree->num_nodes(); i++) {
+            n_features = max(n_features, nodes[i].feature + 1);
+            n_leaves += nodes[i].feature < 0;
+        }
+        if (n_leaves > MAX_LEAVES) return false;
+    }
+    features.resize(n_features);
+
+    for (int t = 0; t < (int)trees.size(); t++) {
+        tree_leaf_offset.push_back(leaf_class.size());
+        add_tree(trees[t]->flat_nodes(), t, classes);
+    }
+
+    // Sort the nodes of every feature by threshold
+    for (FeatureNodes& fn : features) {
+        vector<int> order(fn.thresholds.size());
+        iota(order.begin(), order.end(), 0);
+        stable_sort(order.begin(), order.end(), [&](int a, int b) { return fn.thresholds[a] < fn.thresholds[b]; });
+        FeatureNodes sorted;
+        for (int i : order) {
+            sorted.thresholds.push_back(fn.thresholds[i]);
+            sorted.tree.push_back(fn.tree[i]);
+            sorted.mask.push_back(fn.mask[i]);
+        }
+        fn = std::move(sorted);
+    }
+    return true;
+}
+
+void QuickScorer::vote_rows(const Dataset& data, int row_begin, int row_end, int* votes) const {
+    int n_trees = tree_leaf_offset.size();
+    // Rows are scored ROWS at a time, interleaved: bits[t * ROWS + b] is the
+    // bitvector of tree t for row b. A node is loaded once per group and its
+    // mask applied to the rows that send it right, a loop over b the compiler
+    // turns into a vector compare, blend and AND.
+    // Bits past the last leaf of a tree may stay set: the exit leaf is never
+    // cleared, so the lowest set bit is always a real leaf.
+    constexpr int ROWS = 8;
+    vector<uint64_t> bits((size_t)n_trees * ROWS);
+    size_t n_rows = data.rows;
+
+    // Float32 datasets are read as they are, x is widened like in the tree walk
+    data.with_features([&](auto features_flat) {
+        for (int group = row_begin; group < row_end; group += ROWS) {
+            int n_group = min(ROWS, row_end - group);
+            fill(bits.begin(), bits.end(), ~0ULL);
+
+            for (int f = 0; f < (int)features.size(); f++) {
+                const FeatureNodes& fn = features[f];
+                const double* thresholds = fn.thresholds.data();
+                const int* tree = fn.tree.data();
+                const uint64_t* mask = fn.mask.data();
+                int n = fn.thresholds.size();
+
+                // Nodes [0, end[b]) go right for row b. Same rule as the tree walk,
+                // !(x < threshold) goes right: NaN goes right everywhere
+                int end[ROWS] = {};
+                int min_end = n, max_end = 0;
+                for (int b = 0; b < n_group; b++) {
+                    double x = features_flat[f * n_rows + group + b];
+                    end[b] = std::isnan(x) ? n : upper_bound(thresholds, thresholds + n, x) - thresholds;
+                    min_end = min(min_end, end[b]);
+                    max_end = max(max_end, end[b]);
+                }
+                // Nodes below every row's end go right for the whole group
+                for (int i = 0; i < min_end; i++) {
+                    uint64_t* tree_bits = &bits[(size_t)tree[i] * ROWS];
+                    for (int b = 0; b < ROWS; b++) tree_bits[b] &= mask[i];
+                }
+                for (int i = min_end; i < max_end; i++) {
+                    uint64_t* tree_bits = &bits[(size_t)tree[i] * ROWS];
+                    for (int b = 0; b < ROWS; b++) tree_bits[b] &= (i < end[b]) ? mask[i] : ~0ULL;
+                }
+            }
+
+            for (int b = 0; b < n_group; b++) {
+                int* row_votes = votes + (group + b - row_begin) * n_classes;
+                for (int t = 0; t < n_trees; t++) {
+                    row_votes[leaf_class[tree_leaf_offset[t] + __builtin_ctzll(bits[(size_t)t * ROWS + b])]]++;
+                }
+            }
+        }
+    });
+}
\ No newline at end of file
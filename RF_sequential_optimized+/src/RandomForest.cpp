@@ -1,85 +1,345 @@
-#include <iostream>
-#include <vector>
-#include <map>
-#include <random>
-#include <algorithm>
-#include "RandomForest.h"
-
-using namespace std;
-
-RandomForest::RandomForest(int n) : num_trees(n) {}
-RandomForest::~RandomForest() { for(auto t : trees) delete t; }
-
-void RandomForest::train(const Dataset& data) {
-    cout << "Starting training with " << num_trees << " trees..." << endl;
-    
-    int n_rows = data.rows;
-    int n_cols = data.cols;
-
-    for (int i = 0; i < num_trees; i++) {
-        // Creiamo il dataset bootstrap piatto
-        Dataset bootstrap_data;
-        bootstrap_data.rows = n_rows;
-        bootstrap_data.cols = n_cols;
-        bootstrap_data.features_flat.resize(n_rows * n_cols);
-        bootstrap_data.labels.resize(n_rows);
-
-        std::mt19937 gen(41 + i); 
-        std::uniform_int_distribution<> dis(0, n_rows - 1);
-        
-        // Generiamo prima tutti gli indici random
-        vector<int> random_indices(n_rows);
-        for(int j=0; j<n_rows; j++) random_indices[j] = dis(gen);
-
-        // Copiamo le LABEL
-        for(int j=0; j<n_rows; j++) bootstrap_data.labels[j] = data.labels[random_indices[j]];
-
-        // Copiamo le FEATURES colonna per colonna (EFFICIENTE!)
-        for (int c = 0; c < n_cols; c++) {
-            int src_offset = c * n_rows;
-            int dst_offset = c * n_rows; // In questo caso le dimensioni sono uguali
-            
-            for (int r = 0; r < n_rows; r++) {
-                int original_idx = random_indices[r];
-                bootstrap_data.features_flat[dst_offset + r] = data.features_flat[src_offset + original_idx];
-            }
-        }
-
-        DecisionTree* tree = new DecisionTree(10, 2); 
-        tree->fit(bootstrap_data); // Passiamo il dataset piatto
-        trees.push_back(tree);
-        
-        if ((i+1) % 10 == 0) cout << "Albero " << i+1 << " / " << num_trees << " completato." << endl;
-    }
-}
-
-void RandomForest::predict(const Dataset& data) {
-    cout << "Starting prediction..." << endl;
-    int correct = 0;
-    
-    // Per predire dobbiamo estrarre le righe dal formato colonna (lento ma accettabile in test)
-    for (int i = 0; i < data.rows; i++) {
-        vector<double> row(data.cols);
-        for(int c = 0; c < data.cols; c++) {
-            row[c] = data.features_flat[c * data.rows + i];
-        }
-
-        map<int, int> votes;
-        for (auto tree : trees) {
-            int prediction = tree->predict(row);
-            votes[prediction]++;
-        }
-        
-        int best_class = -1, max_votes = -1;
-        for (auto const& [cls, count] : votes) {
-            if (count > max_votes) {
-                max_votes = count;
-                best_class = cls;
-            }
-        }
-        
-        if (best_class == data.labels[i]) correct++;
-    }
-    
-    cout << "Accuracy: " << (double)correct / data.rows * 100.0 << "%" << endl;
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include "RandomForest.h"
+#include "Farm.h"
+#include "Random.h"
+
+using namespace std;
+
+RandomForest::RandomForest(int n, int n_threads, SplitMode mode)
+    : num_trees(n), num_threads(n_threads), split_mode(mode) {}
+RandomForest::~RandomForest() { for(auto t : trees) delete t; }
+
+uint64_t RandomForest::tree_key(int i) const {
+    return stream_key(seed, i);
+}
+
+vector<int> RandomForest::bootstrap_counts(const Dataset& data, int i) const {
+    int n_rows = data.rows;
+
+    // Every tree owns its stream, so the result does not depend on which thread builds it
+    CounterRng rng(stream_key(tree_key(i), 0));
+    
+    // The bootstrap is only a multiplicity per row: the tree reads features,
+    // bins and labels of the shared training set, nothing is copied
+    vector<int> sample_counts(n_rows, 0);
+    for(int j=0; j<n_rows; j++) sample_counts[rng.bounded(n_rows)]++;
+    return sample_counts;
+}
+
+DecisionTree* RandomForest::fit_tree(const Dataset& data, int i, const vector<int>& sample_counts, TaskScheduler* sched) const {
+    DecisionTree* tree = new DecisionTree(max_depth, 2, split_mode);
+    tree->set_max_features(max_features, tree_key(i));
+    tree->fit(data, sample_counts, sched);
+    return tree;
+}
+
+DecisionTree* RandomForest::build_tree(const Dataset& data, int i, TaskScheduler* sched) const {
+    return fit_tree(data, i, bootstrap_counts(data, i), sched);
+}
+
+void RandomForest::training_memory(const Dataset& data, size_t& shared, size_t& per_tree) const {
+    // Per tree: the sample counts and the index vectors of the nodes being built
+    // (the presorted engine adds one sorted list per feature); shared: the
+    // training set itself, which the trees read in place, and the split-search
+    // buffers of every building thread (they belong to threads, not trees)
+    size_t n = data.rows;
+    per_tree = n * sizeof(int) * 5;
+    if (split_mode == SplitMode::Presorted) per_tree += n * data.cols * sizeof(int);
+    shared = max(1, num_threads) * DecisionTree::split_scratch_bytes(data, split_mode) +
+             data.bins.size() + data.wide_bins.size() * sizeof(uint16_t) +
+             data.features_flat.size() * sizeof(double) + data.features_f32.size() * sizeof(float) +
+             data.labels.size() * sizeof(int) + data.class_ids.size() * sizeof(int);
+}
+
+bool RandomForest::fits_memory_budget(const Dataset& data) const {
+    if (memory_budget == 0) return true;
+    size_t shared, per_tree;
+    training_memory(data, shared, per_tree);
+    if (shared + per_tree > memory_budget) {
+        cerr << "Error: memory budget of " << memory_budget / (1 << 20) << " MB is too small: the training set takes "
+             << shared / (1 << 20) << " MB and every tree being built " << per_tree / (1 << 20) << " MB" << endl;
+        return false;
+    }
+    return true;
+}
+
+int RandomForest::max_live_trees(const Dataset& data) const {
+    if (memory_budget == 0) return num_trees;
+    size_t shared, per_tree;
+    training_memory(data, shared, per_tree);
+    // fits_memory_budget has checked that one tree fits
+    return max<size_t>(1, min<size_t>(num_trees, (memory_budget - shared) / per_tree));
+}
+
+bool RandomForest::train(const Dataset& data) {
+    if (!fits_memory_budget(data)) return false;
+    int n_workers = max(1, num_threads);
+    cout << "Starting training with " << num_trees << " trees on " << n_workers << " threads..." << endl;
+
+    // Slot i always receives tree i, so the forest is identical to the sequential one
+    for (auto t : trees) delete t;
+    trees.assign(num_trees, nullptr);
+    build_trees(data, 0, num_trees);
+
+    build_quick_scorer();
+    return true;
+}
+
+void RandomForest::build_trees(const Dataset& data, int tree_begin, int tree_end) {
+    int n_workers = max(1, num_threads);
+    int n_build = tree_end - tree_begin;
+
+    // Sorted class labels, the vote arrays of predict() are indexed by position here
+    if (!data.classes.empty()) {
+        classes = data.classes;
+    } else {
+        vector<int> class_ids;
+        encode_labels(data.label_data(), data.rows, classes, class_ids);
+    }
+
+    if (n_workers == 1) {
+        for (int i = tree_begin; i < tree_end; i++) {
+            trees[i] = build_tree(data, i, nullptr);
+            int done = i - tree_begin + 1;
+            if (done % 10 == 0) cout << "Albero " << done << " / " << n_build << " completato." << endl;
+        }
+        return;
+    }
+
+    // At most max_live trees are in memory at the same time
+    int max_live = min(n_build, max_live_trees(data));
+    if (train_engine == TrainEngine::Farm) {
+        build_trees_farm(data, tree_begin, tree_end, max_live);
+        return;
+    }
+
+    // One work-stealing pool for everything: every tree is a task, and its large
+    // nodes spawn subtree tasks on the same pool. With few trees the idle workers
+    // steal node tasks, with many trees they mostly run whole trees; in both cases
+    // there are never more than n_workers threads.
+    TaskScheduler scheduler(n_workers);
+    atomic<int> next_tree(0);
+    atomic<int> completed(0);
+    mutex print_mutex;
+
+    // A tree task that finishes starts the next tree, nobody blocks waiting for memory
+    TaskGroup forest(scheduler);
+    function<void()> run_next = [&]() {
+        int i = tree_begin + next_tree++;
+        if (i >= tree_end) return;
+        trees[i] = build_tree(data, i, &scheduler);
+        int done = ++completed;
+        if (done % 10 == 0) {
+            lock_guard<mutex> lock(print_mutex);
+            cout << "Albero " << done << " / " << n_build << " completato." << endl;
+        }
+        forest.run(run_next);
+    };
+    for (int k = 0; k < max_live; k++) forest.run(run_next);
+    forest.wait();
+    // This thread ran node tasks while waiting; the workers free theirs on exit
+    DecisionTree::release_split_scratch();
+}
+
+void RandomForest::build_trees_farm(const Dataset& data, int tree_begin, int tree_end, int max_live) {
+    int n_build = tree_end - tree_begin;
+    struct TreeTask {
+        int index;
+        vector<int> sample_counts;
+    };
+    using TreeResult = pair<int, DecisionTree*>;
+
+    // Trees in flight are the ones being fitted plus the bootstraps queued for
+    // them, so workers and queue share the memory budget
+    int n_workers = min(max(1, num_threads), max_live);
+    size_t queue_capacity = max(1, min(n_workers, max_live - n_workers));
+
+    // Emitter: draws the bootstraps in tree order while the workers fit the previous ones
+    int next_tree = tree_begin;
+    auto emit = [&](TreeTask& task) {
+        if (next_tree >= tree_end) return false;
+        task.index = next_tree++;
+        task.sample_counts = bootstrap_counts(data, task.index);
+        return true;
+    };
+    // Workers: the bootstrap is released as soon as its tree is built
+    auto fit = [&](TreeTask& task) {
+        TreeResult result(task.index, fit_tree(data, task.index, task.sample_counts, nullptr));
+        vector<int>().swap(task.sample_counts);
+        return result;
+    };
+    // Collector: tree i goes to slot i, whatever order the trees complete in
+    int completed = 0;
+    auto collect = [&](TreeResult& result) {
+        trees[result.first] = result.second;
+        if (++completed % 10 == 0) cout << "Albero " << completed << " / " << n_build << " completato." << endl;
+    };
+
+    Farm<TreeTask, TreeResult> farm(emit, fit, collect, n_workers, queue_capacity);
+    farm.run();
+}
+
+void RandomForest::set_predict_engine(PredictEngine engine) {
+    predict_engine = engine;
+    build_quick_scorer();
+}
+
+void RandomForest::build_quick_scorer() {
+    // The QuickScorer tables are derived from the trained trees
+    if (predict_engine != PredictEngine::QuickScorer || trees.empty()) return;
+    if (!quick_scorer.build(trees, classes)) {
+        cerr << "Warning: QuickScorer needs trees with at most " << QuickScorer::MAX_LEAVES
+             << " leaves (max depth 6), using the tree walk" << endl;
+    }
+}
+
+int RandomForest::num_features() const {
+    int n = 0;
+    for (auto tree : trees) {
+        const FlatNode* nodes = tree->flat_nodes();
+        for (int i = 0; i < tree->num_nodes(); i++) n = max(n, nodes[i].feature + 1);
+    }
+    return n;
+}
+
+vector<int> RandomForest::predict(const Dataset& data) const {
+    return predict(data, 0, data.rows);
+}
+
+void RandomForest::vote_block(const Dataset& data, int block_begin, int block_end, int tree_begin, int tree_end,
+                              int* leaf_labels, int* votes) const {
+    int n_classes = classes.size();
+    int block_rows = block_end - block_begin;
+
+    // The QuickScorer tables cover the whole forest, a share of it uses the tree walk
+    if (predict_engine == PredictEngine::QuickScorer && !quick_scorer.empty() && tree_begin == 0 &&
+        tree_end == (int)trees.size()) {
+        quick_scorer.vote_rows(data, block_begin, block_end, votes);
+        return;
+    }
+
+    SimdKernel kernel = (predict_engine == PredictEngine::Scalar) ? SimdKernel::Scalar : best_simd_kernel();
+    for (int t = tree_begin; t < tree_end; t++) {
+        trees[t]->predict_rows(data, block_begin, block_end, leaf_labels, kernel);
+        if (n_classes == 2) {
+            // Binary problems: the class id is a single compare
+            for (int r = 0; r < block_rows; r++) votes[r * 2 + (leaf_labels[r] == classes[1])]++;
+        } else {
+            for (int r = 0; r < block_rows; r++) {
+                int k = lower_bound(classes.begin(), classes.end(), leaf_labels[r]) - classes.begin();
+                votes[r * n_classes + k]++;
+            }
+        }
+    }
+}
+
+int RandomForest::majority_class(const int* votes) const {
+    // Ties go to the smallest label, as with the ordered map used before
+    int n_classes = classes.size();
+    int best = 0;
+    for (int k = 1; k < n_classes; k++) if (votes[k] > votes[best]) best = k;
+    return classes[best];
+}
+
+TaskScheduler& RandomForest::thread_pool() const {
+    lock_guard<mutex> lock(pool_mutex);
+    if (!pool) pool.reset(new TaskScheduler(max(1, num_threads)));
+    return *pool;
+}
+
+void RandomForest::for_each_row_range(int row_begin, int row_end, const function<void(int, int)>& fn) const {
+    int n_blocks = (row_end - row_begin + PREDICT_BLOCK - 1) / PREDICT_BLOCK;
+    int n_workers = max(1, min(num_threads, n_blocks));
+    if (n_workers == 1) {
+        fn(row_begin, row_end);
+        return;
+    }
+
+    // Blocks are independent: contiguous ranges of blocks go to the workers
+    TaskGroup group(thread_pool());
+    int per_task = (n_blocks + n_workers - 1) / n_workers;
+    for (int first = 0; first < n_blocks; first += per_task) {
+        int range_begin = row_begin + first * PREDICT_BLOCK;
+        int range_end = min(row_end, range_begin + per_task * PREDICT_BLOCK);
+        group.run([&fn, range_begin, range_end]() { fn(range_begin, range_end); });
+    }
+    group.wait();
+}
+
+vector<int> RandomForest::predict(const Dataset& data, int row_begin, int row_end) const {
+    vector<int> predictions(max(0, row_end - row_begin));
+    int n_classes = classes.size();
+    if (predictions.empty() || n_classes == 0) return predictions;
+
+    // Rows are scored in blocks: every tree visits the whole block before the
+    // next tree, so its nodes stay in cache, and the votes of the block live in
+    // a small dense array instead of a map per row. No allocation per row.
+    for_each_row_range(row_begin, row_end, [&](int range_begin, int range_end) {
+        vector<int> leaf_labels(PREDICT_BLOCK);
+        vector<int> votes(PREDICT_BLOCK * n_classes);
+        for (int block_begin = range_begin; block_begin < range_end; block_begin += PREDICT_BLOCK) {
+            int block_end = min(range_end, block_begin + PREDICT_BLOCK);
+            fill(votes.begin(), votes.end(), 0);
+            vote_block(data, block_begin, block_end, 0, trees.size(), leaf_labels.data(), votes.data());
+            for (int r = block_begin; r < block_end; r++) {
+                predictions[r - row_begin] = majority_class(&votes[(r - block_begin) * n_classes]);
+            }
+        }
+    });
+    return predictions;
+}
+
+vector<float> RandomForest::predict_proba(const Dataset& data) const {
+    return predict_proba(data, 0, data.rows);
+}
+
+vector<float> RandomForest::predict_proba(const Dataset& data, int row_begin, int row_end) const {
+    int n_classes = classes.size();
+    int n_rows = max(0, row_end - row_begin);
+    vector<float> proba((size_t)n_rows * n_classes);
+    if (n_rows == 0 || n_classes == 0 || trees.empty()) return proba;
+
+    // Same blocks as predict(). The sums of a block are stored class by class
+    // (PREDICT_BLOCK floats per class), so adding the leaves of a tree is, for
+    // every class, a gather-add over the rows that the compiler vectorizes.
+    SimdKernel kernel = (predict_engine == PredictEngine::Scalar) ? SimdKernel::Scalar : best_simd_kernel();
+    float scale = 1.0f / trees.size();
+    for_each_row_range(row_begin, row_end, [&](int range_begin, int range_end) {
+        vector<int> leaves(PREDICT_BLOCK);
+        vector<float> sums((size_t)n_classes * PREDICT_BLOCK);
+        for (int block_begin = range_begin; block_begin < range_end; block_begin += PREDICT_BLOCK) {
+            int block_rows = min(range_end, block_begin + PREDICT_BLOCK) - block_begin;
+            fill(sums.begin(), sums.end(), 0.0f);
+
+            for (auto tree : trees) {
+                const float* dist = tree->leaf_distributions();
+                if (dist && tree->distribution_classes() == n_classes) {
+                    tree->predict_leaves(data, block_begin, block_begin + block_rows, leaves.data(), kernel);
+                    for (int k = 0; k < n_classes; k++) {
+                        float* sum = &sums[(size_t)k * PREDICT_BLOCK];
+                        const float* dist_k = dist + k;
+                        for (int r = 0; r < block_rows; r++) sum[r] += dist_k[leaves[r] * n_classes];
+                    }
+                } else {
+                    // Trees of version 1 model files have no distributions: their label is one vote
+                    tree->predict_rows(data, block_begin, block_begin + block_rows, leaves.data(), kernel);
+                    for (int r = 0; r < block_rows; r++) {
+                        int k = lower_bound(classes.begin(), classes.end(), leaves[r]) - classes.begin();
+                        sums[(size_t)k * PREDICT_BLOCK + r] += 1.0f;
+                    }
+                }
+            }
+
+            float* out = &proba[(size_t)(block_begin - row_begin) * n_classes];
+            for (int r = 0; r < block_rows; r++) {
+                for (int k = 0; k < n_classes; k++) out[r * n_classes + k] = sums[(size_t)k * PREDICT_BLOCK + r] * scale;
+            }
+        }
+    });
+    return proba;
 }
\ No newline at end of file
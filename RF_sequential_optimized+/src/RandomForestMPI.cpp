@@ -0,0 +1,101 @@
+#ifdef USE_MPI
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "RandomForest.h"
+
+using namespace std;
+
+// Rank r owns trees [share_begin(r), share_begin(r + 1)): contiguous shares keep
+// the gathered forest in tree order
+static int share_begin(int num_trees, int rank, int size) {
+    return (int)((long long)num_trees * rank / size);
+}
+
+bool RandomForest::train_mpi(const Dataset& data, MPI_Comm comm) {
+    // Every rank holds the same training set, so they all agree on the budget
+    if (!fits_memory_budget(data)) return false;
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int tree_begin = share_begin(num_trees, rank, size);
+    int tree_end = share_begin(num_trees, rank + 1, size);
+    if (rank == 0) {
+        cout << "Starting distributed training with " << num_trees << " trees on " << size << " processes x "
+             << max(1, num_threads) << " threads..." << endl;
+    }
+
+    // The streams of tree i are keyed by (seed, i), whichever rank builds it
+    for (auto t : trees) delete t;
+    trees.assign(num_trees, nullptr);
+    build_trees(data, tree_begin, tree_end);
+
+    // The shares travel in the model file format and every rank receives all of
+    // them: the root can save the forest and every rank can vote with its share
+    string local = serialize_trees(tree_begin, tree_end);
+    int local_bytes = local.size();
+    vector<int> bytes(size), displs(size);
+    MPI_Allgather(&local_bytes, 1, MPI_INT, bytes.data(), 1, MPI_INT, comm);
+    long long total = 0;
+    for (int r = 0; r < size; r++) {
+        displs[r] = total;
+        total += bytes[r];
+    }
+    vector<char> all(total);
+    MPI_Allgatherv(local.data(), local_bytes, MPI_CHAR, all.data(), bytes.data(), displs.data(), MPI_CHAR, comm);
+
+    for (int r = 0; r < size; r++) {
+        if (r == rank) continue;
+        if (!deserialize_trees(all.data() + displs[r], bytes[r], share_begin(num_trees, r, size))) {
+            cerr << "Error: rank " << rank << " received corrupted trees from rank " << r << endl;
+            MPI_Abort(comm, 1);
+        }
+    }
+
+    build_quick_scorer();
+    return true;
+}
+
+vector<int> RandomForest::predict_mpi(const Dataset& data, MPI_Comm comm) const {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int n_trees = trees.size();
+    int tree_begin = share_begin(n_trees, rank, size);
+    int tree_end = share_begin(n_trees, rank + 1, size);
+
+    vector<int> predictions(rank == 0 ? data.rows : 0);
+    int n_classes = classes.size();
+    if (data.rows == 0 || n_classes == 0) return predictions;
+
+    // Votes are reduced one chunk of rows at a time, so the buffers (and the
+    // messages) stay bounded whatever the size of data
+    const int chunk_rows = PREDICT_BLOCK * 1024;
+    vector<int> votes(min(data.rows, chunk_rows) * n_classes);
+    vector<int> total(rank == 0 ? votes.size() : 0);
+    for (int chunk_begin = 0; chunk_begin < data.rows; chunk_begin += chunk_rows) {
+        int chunk_end = min(data.rows, chunk_begin + chunk_rows);
+        int n_votes = (chunk_end - chunk_begin) * n_classes;
+        fill(votes.begin(), votes.begin() + n_votes, 0);
+
+        for_each_row_range(chunk_begin, chunk_end, [&](int range_begin, int range_end) {
+            vector<int> leaf_labels(PREDICT_BLOCK);
+            for (int block_begin = range_begin; block_begin < range_end; block_begin += PREDICT_BLOCK) {
+                vote_block(data, block_begin, min(range_end, block_begin + PREDICT_BLOCK), tree_begin, tree_end,
+                           leaf_labels.data(), &votes[(block_begin - chunk_begin) * n_classes]);
+            }
+        });
+
+        MPI_Reduce(votes.data(), total.data(), n_votes, MPI_INT, MPI_SUM, 0, comm);
+        if (rank == 0) {
+            for (int r = chunk_begin; r < chunk_end; r++) {
+                predictions[r] = majority_class(&total[(r - chunk_begin) * n_classes]);
+            }
+        }
+    }
+    return predictions;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "TaskScheduler.h"
+
+using namespace std;
+
+// Identifies the scheduler (and the slot inside it) the current thread is working for
+static thread_local const TaskScheduler* tls_scheduler = nullptr;
+static thread_local int tls_slot = 0;
+
+TaskScheduler::TaskScheduler(int n_threads) : queues(max(1, n_threads)) {
+    for (int s = 1; s < (int)queues.size(); s++) {
+        workers.emplace_back(&TaskScheduler::worker_loop, this, s);
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        lock_guard<mutex> lock(sleep_mutex);
+        stop = true;
+    }
+    sleep_cv.notify_all();
+    for (auto& w : workers) w.join();
+}
+
+int TaskScheduler::current_slot() const {
+    return (tls_scheduler == this) ? tls_slot : 0;
+}
+
+void TaskScheduler::push(Task task) {
+    WorkQueue& q = queues[current_slot()];
+    {
+        lock_guard<mutex> lock(q.m);
+        q.tasks.push_back(std::move(task));
+    }
+    {
+        // Taking the lock avoids losing the wake-up of a worker that is about to sleep
+        lock_guard<mutex> lock(sleep_mutex);
+        queued++;
+    }
+    sleep_cv.notify_one();
+}
+
+bool TaskScheduler::try_run_one(int slot) {
+    int n = (int)queues.size();
+    Task task;
+    bool found = false;
+
+    // Own queue first (newest task), then steal the oldest task of the other slots
+    for (int k = 0; k < n && !found; k++) {
+        WorkQueue& q = queues[(slot + k) % n];
+        lock_guard<mutex> lock(q.m);
+        if (q.tasks.empty()) continue;
+        if (k == 0) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        } else {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+        found = true;
+    }
+    if (!found) return false;
+
+    queued--;
+    task.fn();
+    task.group->pending--;
+    return true;
+}
+
+void TaskScheduler::worker_loop(int slot) {
+    tls_scheduler = this;
+    tls_slot = slot;
+
+    while (true) {
+        if (try_run_one(slot)) continue;
+
+        unique_lock<mutex> lock(sleep_mutex);
+        sleep_cv.wait(lock, [this] { return stop || queued > 0; });
+        if (stop && queued == 0) return;
+    }
+}
+
+void TaskGroup::run(function<void()> fn) {
+    pending++;
+    scheduler.push({std::move(fn), this});
+}
+
+void TaskGroup::wait() {
+    int slot = scheduler.current_slot();
+    while (pending > 0) {
+        // Help instead of blocking: the tasks we wait for may be in our own queue
+        if (!scheduler.try_run_one(slot)) this_thread::yield();
+    }
+}
\ No newline at end of file
@@ -1,162 +1,717 @@
-#include "Tree.h"
-#include <vector>
-#include <map>
-#include <limits>
-#include <algorithm>
-#include <numeric>
-
-using namespace std;
-
-Node::~Node() { delete left; delete right; }
-DecisionTree::DecisionTree(int depth, int min_samples) : max_depth(depth), min_size(min_samples) {}
-DecisionTree::~DecisionTree() { delete root; }
-
-// Optimized best split search using flat feature storage
-void DecisionTree::get_best_split(const vector<double>& features_flat, int n_total_rows,
-                                  const vector<int>& labels,
-                                  const vector<int>& node_indices, 
-                                  int& best_feat, double& best_thresh, double& best_gini, 
-                                  vector<int>& left_idx, vector<int>& right_idx) {
-    
-    // initialize bests
-    best_gini = numeric_limits<double>::max();
-    int n_subset = node_indices.size();
-    if (n_subset < 2) return;
-    
-    // number of features, inferred from flat storage
-    int n_cols = features_flat.size() / n_total_rows;
-
-    map<int, int> total_counts;
-    for (int idx : node_indices) total_counts[labels[idx]]++;
-
-    vector<int> sorted_indices = node_indices; 
-
-    for (int f = 0; f < n_cols; f++) {
-        // --- OTTIMIZZAZIONE CACHE ---
-        // Otteniamo un puntatore diretto all'inizio della colonna 'f'.
-        // Tutti i dati di questa feature sono contigui in memoria: features[offset], features[offset+1]...
-        const double* col_ptr = &features_flat[f * n_total_rows];
-
-        // Il sort ora è rapidissimo perché la lambda legge memoria sequenziale
-        sort(sorted_indices.begin(), sorted_indices.end(), [col_ptr](int a, int b) {
-            return col_ptr[a] < col_ptr[b];
-        });
-
-        // Setup Scan (uguale a prima)
-        map<int, int> left_counts;
-        map<int, int> right_counts = total_counts;
-        int n_left = 0;
-        int n_right = n_subset;
-        double sum_sq_left = 0.0;
-        double sum_sq_right = 0.0;
-        for(auto const& [l, c] : right_counts) sum_sq_right += (double)c*c;
-
-        for (int i = 0; i < n_subset - 1; i++) {
-            int idx = sorted_indices[i];
-            int label = labels[idx];
-            
-            // Accesso veloce tramite puntatore base
-            double val = col_ptr[idx];
-            double next_val = col_ptr[sorted_indices[i+1]];
-
-            double c_r = right_counts[label];
-            sum_sq_right -= c_r * c_r;
-            right_counts[label]--;
-            sum_sq_right += (c_r - 1.0) * (c_r - 1.0);
-            n_right--;
-
-            double c_l = left_counts[label];
-            sum_sq_left -= c_l * c_l;
-            left_counts[label]++;
-            sum_sq_left += (c_l + 1.0) * (c_l + 1.0);
-            n_left++;
-
-            if (val == next_val) continue;
-
-            double gini_left = 1.0 - (sum_sq_left / ((double)n_left * n_left));
-            double gini_right = 1.0 - (sum_sq_right / ((double)n_right * n_right));
-            double weighted = ((double)n_left / n_subset) * gini_left + ((double)n_right / n_subset) * gini_right;
-
-            if (weighted < best_gini) {
-                best_gini = weighted;
-                best_feat = f;
-                best_thresh = (val + next_val) / 2.0;
-            }
-        }
-    }
-
-    if (best_gini != numeric_limits<double>::max()) {
-        left_idx.reserve(n_subset); 
-        right_idx.reserve(n_subset);
-        
-        // Per ricostruire usiamo l'accesso diretto alla feature vincente
-        const double* best_col_ptr = &features_flat[best_feat * n_total_rows];
-        
-        for (int idx : node_indices) {
-            if (best_col_ptr[idx] < best_thresh)
-                left_idx.push_back(idx);
-            else
-                right_idx.push_back(idx);
-        }
-    }
-}
-
-Node* DecisionTree::build_recursive(const vector<double>& features_flat, int n_total_rows,
-                                    const vector<int>& labels, 
-                                    const vector<int>& node_indices, 
-                                    int depth) {
-    Node* node = new Node();
-
-    bool all_same = true;
-    int first_label = labels[node_indices[0]];
-    for (size_t i = 1; i < node_indices.size(); i++) {
-        if (labels[node_indices[i]] != first_label) { all_same = false; break; }
-    }
-
-    if (depth >= max_depth || node_indices.size() <= (size_t)min_size || all_same) {
-        node->is_leaf = true;
-        map<int, int> counts;
-        for (int idx : node_indices) counts[labels[idx]]++;
-        int most_freq = -1, max_c = -1;
-        for (auto p : counts) if (p.second > max_c) { max_c = p.second; most_freq = p.first; }
-        node->label = most_freq;
-        return node;
-    }
-
-    int best_feat = 0;
-    double best_thresh = 0.0, best_gini = 1.0;
-    vector<int> left_idx, right_idx;
-
-    get_best_split(features_flat, n_total_rows, labels, node_indices, best_feat, best_thresh, best_gini, left_idx, right_idx);
-
-    if (left_idx.empty() || right_idx.empty()) {
-        node->is_leaf = true;
-        map<int, int> counts;
-        for (int idx : node_indices) counts[labels[idx]]++;
-        int most_freq = -1, max_c = -1;
-        for (auto p : counts) if (p.second > max_c) { max_c = p.second; most_freq = p.first; }
-        node->label = most_freq;
-        return node;
-    }
-
-    node->feature_index = best_feat;
-    node->threshold = best_thresh;
-    node->left = build_recursive(features_flat, n_total_rows, labels, left_idx, depth + 1);
-    node->right = build_recursive(features_flat, n_total_rows, labels, right_idx, depth + 1);
-
-    return node;
-}
-
-void DecisionTree::fit(const Dataset& train_data) {
-    vector<int> all_indices(train_data.rows);
-    iota(all_indices.begin(), all_indices.end(), 0);
-    root = build_recursive(train_data.features_flat, train_data.rows, train_data.labels, all_indices, 0);
-}
-
-int DecisionTree::predict_one(Node* node, const vector<double>& row) {
-    if (node->is_leaf) return node->label;
-    if (row[node->feature_index] < node->threshold) return predict_one(node->left, row);
-    else return predict_one(node->right, row);
-}
-
-int DecisionTree::predict(const vector<double>& row) { return predict_one(root, row); }
\ No newline at end of file
+#include "Tree.h"
+#include "Random.h"
+#include <iostream>
+#include <vector>
+#include <type_traits>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <mutex>
+
+using namespace std;
+
+DecisionTree::DecisionTree(int depth, int min_samples, SplitMode mode, int node_task_cutoff, int split_task_cutoff)
+    : max_depth(depth), min_size(min_samples), split_mode(mode),
+      task_cutoff(node_task_cutoff), feature_task_cutoff(split_task_cutoff) {}
+DecisionTree::~DecisionTree() {}
+
+int MaxFeatures::resolve(int n_features) const {
+    int k = n_features;
+    switch (kind) {
+        case Sqrt: k = (int)std::sqrt((double)n_features); break;
+        case Log2: k = (int)std::log2((double)n_features); break;
+        case Fraction: k = (int)(value * n_features); break;
+        case Count: k = (int)value; break;
+        default: break;
+    }
+    return max(1, min(k, n_features));
+}
+
+bool MaxFeatures::parse(const string& text, MaxFeatures& out) {
+    if (text == "all") { out = {All, 0.0}; return true; }
+    if (text == "sqrt") { out = {Sqrt, 0.0}; return true; }
+    if (text == "log2") { out = {Log2, 0.0}; return true; }
+    size_t used = 0;
+    double v = 0.0;
+    try { v = stod(text, &used); } catch (...) { return false; }
+    if (used != text.size() || v <= 0.0) return false;
+    // "1" is one feature, "0.5" half of them
+    if (text.find('.') != string::npos && v <= 1.0) out = {Fraction, v};
+    else out = {Count, v};
+    return true;
+}
+
+void DecisionTree::set_max_features(MaxFeatures mtry, uint64_t seed) {
+    max_features = mtry;
+    random_seed = seed;
+}
+
+// Draws k of n features, every subset equally likely, with selection sampling
+// (Knuth's algorithm S): take() is asked about the features in increasing order
+// and says whether to use each one. Only two counters and the generator state:
+// nothing to allocate or shuffle per node.
+class FeatureSampler {
+    CounterRng rng;
+    int features_left;
+    int picks_left;
+public:
+    FeatureSampler(uint64_t stream, int n, int k) : rng(stream), features_left(n), picks_left(k) {}
+    bool take() {
+        bool pick = picks_left >= features_left;
+        if (!pick) {
+            // picks_left out of features_left
+            pick = (int)rng.bounded(features_left) < picks_left;
+        }
+        features_left--;
+        if (pick) picks_left--;
+        return pick;
+    }
+};
+
+// Best threshold found on a single feature
+struct FeatureSplit {
+    double gini = numeric_limits<double>::max();
+    double threshold = 0.0;
+};
+
+// Per-class counts indexed by dense class id. K > 0 fixes the number of classes
+// at compile time (K = 2 for binary problems): a small array on the stack and
+// loops the compiler unrolls. K = 0 takes the number of classes at runtime:
+// still on the stack up to INLINE classes, only larger problems allocate.
+template <int K>
+struct ClassCounts {
+    int count[K] = {};
+    explicit ClassCounts(int) {}
+    int& operator[](int k) { return count[k]; }
+};
+template <>
+struct ClassCounts<0> {
+    static constexpr int INLINE = 32;
+    int inline_count[INLINE];
+    vector<int> heap_count;
+    int* count;
+    explicit ClassCounts(int n_classes) {
+        if (n_classes <= INLINE) {
+            fill(inline_count, inline_count + n_classes, 0);
+            count = inline_count;
+        } else {
+            heap_count.assign(n_classes, 0);
+            count = heap_count.data();
+        }
+    }
+    ClassCounts(const ClassCounts&) = delete;
+    ClassCounts& operator=(const ClassCounts&) = delete;
+    int& operator[](int k) { return count[k]; }
+};
+
+// Calls f with integral_constant<int, K>: K = 2 for binary problems, 0 otherwise
+template <typename F>
+static decltype(auto) with_class_count(int n_classes, F&& f) {
+    if (n_classes == 2) return f(integral_constant<int, 2>());
+    return f(integral_constant<int, 0>());
+}
+
+// Scans every threshold of rows already sorted by one feature, updating the
+// gini coefficient incrementally. Row idx counts weights[idx] times (its
+// multiplicity in the bootstrap sample); n_subset is the total weight.
+// T is the feature storage type (double or float), thresholds are double.
+template <int K, typename T>
+static FeatureSplit scan_sorted(const T* col_ptr, const int* class_ids, const int* weights,
+                                const int* sorted_indices, int n_entries, int n_subset,
+                                const int* total_counts, int n_classes) {
+    FeatureSplit best;
+    const int nk = (K > 0) ? K : n_classes;
+
+    // Setup Scan (uguale a prima)
+    ClassCounts<K> left_counts(nk), right_counts(nk);
+    int n_left = 0;
+    int n_right = n_subset;
+    double sum_sq_left = 0.0;
+    double sum_sq_right = 0.0;
+    for (int k = 0; k < nk; k++) {
+        right_counts[k] = total_counts[k];
+        sum_sq_right += (double)total_counts[k] * total_counts[k];
+    }
+
+    for (int i = 0; i < n_entries - 1; i++) {
+        int idx = sorted_indices[i];
+        int label = class_ids[idx];
+        int w = weights[idx];
+        
+        // Accesso veloce tramite puntatore base
+        double val = col_ptr[idx];
+        double next_val = col_ptr[sorted_indices[i+1]];
+
+        double c_r = right_counts[label];
+        sum_sq_right -= c_r * c_r;
+        right_counts[label] -= w;
+        sum_sq_right += (c_r - w) * (c_r - w);
+        n_right -= w;
+
+        double c_l = left_counts[label];
+        sum_sq_left -= c_l * c_l;
+        left_counts[label] += w;
+        sum_sq_left += (c_l + w) * (c_l + w);
+        n_left += w;
+
+        if (val == next_val) continue;
+
+        double gini_left = 1.0 - (sum_sq_left / ((double)n_left * n_left));
+        double gini_right = 1.0 - (sum_sq_right / ((double)n_right * n_right));
+        double weighted = ((double)n_left / n_subset) * gini_left + ((double)n_right / n_subset) * gini_right;
+
+        if (weighted < best.gini) {
+            best.gini = weighted;
+            best.threshold = (val + next_val) / 2.0;
+        }
+    }
+    return best;
+}
+
+// Sorts the node rows by one feature and scans them. sorted_indices is reordered in place.
+template <int K, typename T>
+static FeatureSplit scan_feature(const T* col_ptr, const int* class_ids, const int* weights,
+                                 vector<int>& sorted_indices, int n_subset, const int* total_counts, int n_classes) {
+    // Il sort ora è rapidissimo perché la lambda legge memoria sequenziale
+    sort(sorted_indices.begin(), sorted_indices.end(), [col_ptr](int a, int b) {
+        return col_ptr[a] < col_ptr[b];
+    });
+    return scan_sorted<K>(col_ptr, class_ids, weights, sorted_indices.data(), sorted_indices.size(), n_subset,
+                          total_counts, n_classes);
+}
+
+// Histogram engine: the node rows are accumulated into per-bin class counts,
+// then only the bin boundaries are scanned. O(n + bins * classes), no sort.
+// A split after bin b sends left the values below cuts[b]. B is the code type.
+template <int K, typename B>
+static FeatureSplit scan_histogram(const B* bin_ptr, const vector<double>& cuts,
+                                   const int* class_ids, int n_classes, const int* weights,
+                                   const int* rows, int n_rows, int n_subset, const int* total_per_class,
+                                   vector<int>& hist) {
+    FeatureSplit best;
+    const int nk = (K > 0) ? K : n_classes;
+    int n_bins = cuts.size() + 1;
+
+    // hist[b * nk + k] = weight of the rows of class k falling in bin b
+    hist.assign(n_bins * nk, 0);
+    for (int i = 0; i < n_rows; i++) {
+        int idx = rows[i];
+        hist[bin_ptr[idx] * nk + class_ids[idx]] += weights[idx];
+    }
+
+    ClassCounts<K> left_counts(nk);
+    int n_left = 0;
+
+    for (int b = 0; b < n_bins - 1; b++) {
+        int in_bin = 0;
+        for (int k = 0; k < nk; k++) {
+            left_counts[k] += hist[b * nk + k];
+            in_bin += hist[b * nk + k];
+        }
+        n_left += in_bin;
+        int n_right = n_subset - n_left;
+
+        // Same candidates as the exact scan: only after a value present in the node
+        if (in_bin == 0 || n_left == 0 || n_right == 0) continue;
+
+        double sum_sq_left = 0.0, sum_sq_right = 0.0;
+        for (int k = 0; k < nk; k++) {
+            double c_l = left_counts[k];
+            double c_r = total_per_class[k] - left_counts[k];
+            sum_sq_left += c_l * c_l;
+            sum_sq_right += c_r * c_r;
+        }
+
+        double gini_left = 1.0 - (sum_sq_left / ((double)n_left * n_left));
+        double gini_right = 1.0 - (sum_sq_right / ((double)n_right * n_right));
+        double weighted = ((double)n_left / n_subset) * gini_left + ((double)n_right / n_subset) * gini_right;
+
+        if (weighted < best.gini) {
+            best.gini = weighted;
+            best.threshold = cuts[b];
+        }
+    }
+    return best;
+}
+
+// Buffers reused by the split searches of one thread, so that a node allocates
+// nothing once they have grown. Only code that never waits on a TaskGroup uses
+// them: the sequential search and the per-feature tasks. A thread waiting in
+// TaskGroup::wait may run such code for another node, so a node that waits
+// (feature-parallel search) keeps its own buffers.
+struct SplitScratch {
+    vector<int> sorted_indices;
+    vector<FeatureSplit> feature_best;
+    vector<int> class_totals;
+    vector<int> hist;
+};
+static thread_local SplitScratch split_scratch;
+
+void DecisionTree::release_split_scratch() {
+    split_scratch = SplitScratch();
+}
+
+size_t DecisionTree::split_scratch_bytes(const Dataset& data, SplitMode mode) {
+    // The exact engine copies the node rows (the root: all of them), the histogram
+    // one counts bins x classes; both keep a best split per feature
+    size_t n_classes = max<size_t>(1, data.classes.size());
+    size_t bytes = data.cols * sizeof(FeatureSplit) + n_classes * sizeof(int);
+    if (mode == SplitMode::Exact) bytes += (size_t)data.rows * sizeof(int);
+    if (mode == SplitMode::Histogram) {
+        size_t n_bins = 0;
+        for (const auto& cuts : data.bin_cuts) n_bins = max(n_bins, cuts.size() + 1);
+        bytes += n_bins * n_classes * sizeof(int);
+    }
+    return bytes;
+}
+
+// Bump allocator for the Nodes of one fit(): blocks of BLOCK nodes, all freed
+// together. Node tasks allocate concurrently, hence the lock (one per node,
+// nothing next to its split search).
+class NodeArena {
+    static constexpr size_t BLOCK = 1024;
+    vector<unique_ptr<Node[]>> blocks;
+    size_t used = BLOCK;
+    mutex lock;
+public:
+    Node* alloc() {
+        lock_guard<mutex> guard(lock);
+        if (used == BLOCK) {
+            blocks.emplace_back(new Node[BLOCK]);
+            used = 0;
+        }
+        return &blocks.back()[used++];
+    }
+};
+
+// Stable in-place partition of rows[0, n): the rows for which goes_left holds
+// are moved to the front, in their order, and the others follow in theirs.
+// scratch must have room for n ints. Returns the number of left rows.
+template <typename Pred>
+static int stable_partition_rows(int* rows, int n, int* scratch, Pred goes_left) {
+    int l = 0, r = 0;
+    for (int i = 0; i < n; i++) {
+        int idx = rows[i];
+        if (goes_left(idx)) rows[l++] = idx;
+        else scratch[r++] = idx;
+    }
+    copy(scratch, scratch + r, rows + l);
+    return l;
+}
+
+// Optimized best split search using flat feature storage
+void DecisionTree::get_best_split(const Dataset& data, int begin, int end, uint64_t node_id,
+                                  int& best_feat, double& best_thresh, double& best_gini, int& n_left) {
+    
+    // initialize bests
+    best_gini = numeric_limits<double>::max();
+    n_left = 0;
+    int n_subset = node_weight(begin, end);
+    if (n_subset < 2) return;
+
+    // The node rows, partitioned in place at the end
+    int* rows = &node_rows[begin];
+    int n_rows = end - begin;
+    
+    int n_cols = data.cols;
+    bool histogram = (split_mode == SplitMode::Histogram);
+    bool presorted_mode = (split_mode == SplitMode::Presorted);
+    // Only the exact engine sorts: it needs a private copy of the indices
+    bool needs_sort = (split_mode == SplitMode::Exact);
+    int n_try = max_features.resolve(n_cols);
+    bool parallel = scheduler && n_subset >= feature_task_cutoff && n_try > 1;
+
+    // --- OTTIMIZZAZIONE CACHE ---
+    // Per ogni feature usiamo un puntatore diretto all'inizio della colonna 'f'.
+    // Tutti i dati di questa feature sono contigui in memoria: features[offset], features[offset+1]...
+    // Features not drawn by the sampler keep the "no split" sentinel
+    vector<FeatureSplit> own_best;
+    vector<int> own_totals;
+    vector<FeatureSplit>& feature_best = parallel ? own_best : split_scratch.feature_best;
+    vector<int>& total_per_class = parallel ? own_totals : split_scratch.class_totals;
+    feature_best.assign(n_cols, FeatureSplit());
+    total_per_class.assign(n_classes, 0);
+    for (int i = 0; i < n_rows; i++) total_per_class[class_ids[rows[i]]] += sample_weight[rows[i]];
+
+    // Evaluates feature f; the exact engine sorts 'sorted_indices' in place.
+    // Runs on the thread of the caller or of a feature task, whose scratch it uses.
+    auto evaluate = [&](int f, vector<int>& sorted_indices) {
+        return with_class_count(n_classes, [&](auto k) {
+            constexpr int K = decltype(k)::value;
+            if (histogram) {
+                return data.with_bins(f, [&](auto bin_ptr) {
+                    return scan_histogram<K>(bin_ptr, data.bin_cuts[f], class_ids, n_classes,
+                                             sample_weight, rows, n_rows, n_subset, total_per_class.data(),
+                                             split_scratch.hist);
+                });
+            }
+            return data.with_column(f, [&](auto col_ptr) {
+                if (presorted_mode) {
+                    // The node rows are already sorted by f in their segment of the presorted list
+                    return scan_sorted<K>(col_ptr, class_ids, sample_weight,
+                                          &presorted[(size_t)f * presort_rows + begin], n_rows,
+                                          n_subset, total_per_class.data(), n_classes);
+                }
+                return scan_feature<K>(col_ptr, class_ids, sample_weight, sorted_indices, n_subset,
+                                       total_per_class.data(), n_classes);
+            });
+        });
+    };
+
+    FeatureSampler sampler(stream_key(random_seed, node_id), n_cols, n_try);
+
+    if (parallel) {
+        // Large nodes (the root above all): one task per feature, each with its own
+        // copy of the indices since the sort is done in place
+        TaskGroup features(*scheduler);
+        for (int f = 0; f < n_cols; f++) {
+            if (!sampler.take()) continue;
+            features.run([&, f]() {
+                vector<int>& sorted_indices = split_scratch.sorted_indices;
+                if (needs_sort) sorted_indices.assign(rows, rows + n_rows);
+                feature_best[f] = evaluate(f, sorted_indices);
+            });
+        }
+        features.wait();
+    } else {
+        vector<int>& sorted_indices = split_scratch.sorted_indices;
+        if (needs_sort) sorted_indices.assign(rows, rows + n_rows);
+        for (int f = 0; f < n_cols; f++) {
+            if (sampler.take()) feature_best[f] = evaluate(f, sorted_indices);
+        }
+    }
+
+    // Reduction in feature order with a strict comparison: on ties the lowest
+    // feature index wins, exactly like the sequential scan
+    for (int f = 0; f < n_cols; f++) {
+        if (feature_best[f].gini < best_gini) {
+            best_gini = feature_best[f].gini;
+            best_feat = f;
+            best_thresh = feature_best[f].threshold;
+        }
+    }
+
+    if (best_gini != numeric_limits<double>::max()) {
+        // The children get [begin, begin + n_left) and [begin + n_left, end).
+        // Concurrent nodes own disjoint ranges, of the scratch array as well.
+        int* scratch = &partition_scratch[begin];
+
+        if (histogram) {
+            // Only the bin codes are needed (the raw features may not even be in memory):
+            // x < cuts[b] exactly when bin(x) <= b
+            const vector<double>& cuts = data.bin_cuts[best_feat];
+            int best_bin = lower_bound(cuts.begin(), cuts.end(), best_thresh) - cuts.begin();
+            data.with_bins(best_feat, [&](auto best_bin_ptr) {
+                n_left = stable_partition_rows(rows, n_rows, scratch,
+                                               [&](int idx) { return best_bin_ptr[idx] <= best_bin; });
+            });
+            return;
+        }
+
+        // Per ricostruire usiamo l'accesso diretto alla feature vincente
+        data.with_column(best_feat, [&](auto best_col_ptr) {
+            n_left = stable_partition_rows(rows, n_rows, scratch, [&](int idx) {
+                bool left = best_col_ptr[idx] < best_thresh;
+                if (presorted_mode) goes_left[idx] = left;
+                return left;
+            });
+        });
+
+        if (presorted_mode) partition_presorted(begin, n_rows);
+    }
+}
+
+// Stable partition of the node segment of every presorted list, with the same
+// split as the node rows: both children stay sorted in their segments. Rows are
+// unique within a node, so concurrent nodes never touch the same marks or
+// segments. goes_left has been set for the node rows.
+void DecisionTree::partition_presorted(int begin, int n_rows) {
+    int n_cols = presorted.size() / presort_rows;
+
+    for (int f = 0; f < n_cols; f++) {
+        int* segment = &presorted[(size_t)f * presort_rows + begin];
+        stable_partition_rows(segment, n_rows, &partition_scratch[begin], [&](int idx) { return goes_left[idx]; });
+    }
+}
+
+// Number of bootstrap draws falling in the node (rows count with their multiplicity)
+int DecisionTree::node_weight(int begin, int end) const {
+    int total = 0;
+    for (int i = begin; i < end; i++) total += sample_weight[node_rows[i]];
+    return total;
+}
+
+// Most frequent class of the node (weighted); ties go to the smallest label
+int DecisionTree::majority_label(int begin, int end) const {
+    int best = with_class_count(n_classes, [&](auto k) {
+        constexpr int K = decltype(k)::value;
+        const int nk = (K > 0) ? K : n_classes;
+        ClassCounts<K> counts(nk);
+        for (int i = begin; i < end; i++) counts[class_ids[node_rows[i]]] += sample_weight[node_rows[i]];
+        int most_freq = 0;
+        for (int c = 1; c < nk; c++) if (counts[c] > counts[most_freq]) most_freq = c;
+        return most_freq;
+    });
+    return class_labels[best];
+}
+
+void DecisionTree::class_distribution(int begin, int end, float* out) const {
+    ClassCounts<0> counts(n_classes);
+    int total = 0;
+    for (int i = begin; i < end; i++) {
+        int w = sample_weight[node_rows[i]];
+        counts[class_ids[node_rows[i]]] += w;
+        total += w;
+    }
+    for (int k = 0; k < n_classes; k++) out[k] = total > 0 ? (float)counts[k] / total : 0.0f;
+}
+
+Node* DecisionTree::build_recursive(const Dataset& data, int begin, int end,
+                                    int depth, uint64_t node_id) {
+    Node* node = arena->alloc();
+
+    bool all_same = true;
+    int first_class = class_ids[node_rows[begin]];
+    for (int i = begin + 1; i < end; i++) {
+        if (class_ids[node_rows[i]] != first_class) { all_same = false; break; }
+    }
+
+    int n_subset = node_weight(begin, end);
+    if (depth >= max_depth || n_subset <= min_size || all_same) {
+        node->is_leaf = true;
+        node->label = majority_label(begin, end);
+        node->begin = begin;
+        node->end = end;
+        return node;
+    }
+
+    int best_feat = 0;
+    double best_thresh = 0.0, best_gini = 1.0;
+    int n_left = 0;
+
+    get_best_split(data, begin, end, node_id, best_feat, best_thresh, best_gini, n_left);
+
+    if (n_left == 0 || n_left == end - begin) {
+        node->is_leaf = true;
+        node->label = majority_label(begin, end);
+        node->begin = begin;
+        node->end = end;
+        return node;
+    }
+    int mid = begin + n_left;
+
+    node->feature_index = best_feat;
+    node->threshold = best_thresh;
+
+    // Big nodes: the left subtree becomes a task that any idle worker can steal,
+    // while this thread goes on with the right one. Small nodes stay sequential
+    // because the task overhead would exceed the work.
+    if (scheduler && n_subset >= task_cutoff) {
+        TaskGroup children(*scheduler);
+        children.run([&]() {
+            node->left = build_recursive(data, begin, mid, depth + 1, 2 * node_id);
+        });
+        node->right = build_recursive(data, mid, end, depth + 1, 2 * node_id + 1);
+        children.wait();
+    } else {
+        node->left = build_recursive(data, begin, mid, depth + 1, 2 * node_id);
+        node->right = build_recursive(data, mid, end, depth + 1, 2 * node_id + 1);
+    }
+
+    return node;
+}
+
+void DecisionTree::fit(const Dataset& train_data, TaskScheduler* sched) {
+    fit(train_data, vector<int>(train_data.rows, 1), sched);
+}
+
+void DecisionTree::fit(const Dataset& train_data, const vector<int>& sample_counts, TaskScheduler* sched) {
+    // The tree only ever sees the rows drawn at least once; the duplicates are
+    // accounted for by weighting every row with its count
+    vector<int> all_indices;
+    all_indices.reserve(train_data.rows);
+    for (int r = 0; r < train_data.rows; r++) {
+        if (sample_counts[r] > 0) all_indices.push_back(r);
+    }
+    if (all_indices.empty()) {
+        cerr << "Error: fit() called with an empty sample" << endl;
+        exit(1);
+    }
+    sample_weight = sample_counts.data();
+    scheduler = sched;
+
+    // Dense class ids 0..K-1 index every count array: the ones of the loader,
+    // or computed here for a dataset built without them
+    if (train_data.class_ids.empty()) {
+        encode_labels(train_data.label_data(), train_data.rows, own_classes, own_class_ids);
+        class_ids = own_class_ids.data();
+        class_labels = own_classes.data();
+        n_classes = own_classes.size();
+    } else {
+        class_ids = train_data.class_ids.data();
+        class_labels = train_data.classes.data();
+        n_classes = train_data.classes.size();
+    }
+
+    if (split_mode == SplitMode::Histogram && !train_data.has_bins()) {
+        cerr << "Error: histogram split requires build_histogram_bins() on the training data" << endl;
+        exit(1);
+    }
+
+    if (split_mode == SplitMode::Presorted) {
+        // Sort every column once for the whole tree; nodes only partition these lists
+        presort_rows = all_indices.size();
+        presorted.resize((size_t)train_data.cols * presort_rows);
+        goes_left.resize(train_data.rows);
+        auto sort_column = [&](int f) {
+            int* list = &presorted[(size_t)f * presort_rows];
+            copy(all_indices.begin(), all_indices.end(), list);
+            train_data.with_column(f, [&](auto col_ptr) {
+                sort(list, list + presort_rows, [col_ptr](int a, int b) { return col_ptr[a] < col_ptr[b]; });
+            });
+        };
+        if (scheduler) {
+            TaskGroup columns(*scheduler);
+            for (int f = 0; f < train_data.cols; f++) columns.run([&, f]() { sort_column(f); });
+            columns.wait();
+        } else {
+            for (int f = 0; f < train_data.cols; f++) sort_column(f);
+        }
+    }
+
+    // Every node is a range of this one array, split in place by its partition
+    node_rows = std::move(all_indices);
+    partition_scratch.resize(node_rows.size());
+
+    NodeArena nodes_arena;
+    arena = &nodes_arena;
+    Node* root = build_recursive(train_data, 0, node_rows.size(), 0, 1);
+    // Leaf ranges of node_rows are final once the tree is built: flatten reads
+    // the class distributions from them
+    flatten(root);
+    arena = nullptr;
+    scheduler = nullptr;
+    sample_weight = nullptr;
+    class_ids = class_labels = nullptr;
+    vector<int>().swap(own_class_ids);
+    vector<int>().swap(own_classes);
+    vector<int>().swap(presorted);
+    vector<int>().swap(node_rows);
+    vector<int>().swap(partition_scratch);
+    vector<char>().swap(goes_left);
+    release_split_scratch();
+}
+
+void DecisionTree::flatten(const Node* root) {
+    nodes.clear();
+    nodes.push_back({-1, -1, 0.0});
+    flat_depth = 0;
+    leaf_dist.clear();
+    n_leaves = 0;
+    leaf_classes = n_classes;
+
+    // Breadth-first visit: queue[i] is the Node stored in nodes[i]
+    vector<const Node*> queue = {root};
+    vector<int> node_depth = {0};
+    for (size_t i = 0; i < queue.size(); i++) {
+        const Node* node = queue[i];
+        flat_depth = max(flat_depth, node_depth[i]);
+        if (node->is_leaf) {
+            // Leaves are numbered in breadth-first order, like their distributions
+            nodes[i] = {~n_leaves, node->label, 0.0};
+            leaf_dist.resize((size_t)(n_leaves + 1) * leaf_classes);
+            class_distribution(node->begin, node->end, &leaf_dist[(size_t)n_leaves * leaf_classes]);
+            n_leaves++;
+            continue;
+        }
+        // Reserve the two adjacent slots of the children
+        nodes[i] = {node->feature_index, (int)nodes.size(), node->threshold};
+        nodes.push_back({-1, -1, 0.0});
+        nodes.push_back({-1, -1, 0.0});
+        queue.push_back(node->left);
+        queue.push_back(node->right);
+        node_depth.push_back(node_depth[i] + 1);
+        node_depth.push_back(node_depth[i] + 1);
+    }
+
+    node_view = nodes.data();
+    n_nodes = nodes.size();
+    leaf_dist_view = leaf_dist.data();
+    mapping.reset();
+}
+
+void DecisionTree::set_nodes(vector<FlatNode> flat, int depth) {
+    nodes = std::move(flat);
+    node_view = nodes.data();
+    n_nodes = nodes.size();
+    flat_depth = depth;
+    set_leaf_distributions({}, 0, 0);
+    mapping.reset();
+}
+
+void DecisionTree::attach_nodes(const FlatNode* flat, int n, int depth, shared_ptr<const MappedFile> file) {
+    nodes.clear();
+    nodes.shrink_to_fit();
+    node_view = flat;
+    n_nodes = n;
+    flat_depth = depth;
+    set_leaf_distributions({}, 0, 0);
+    mapping = std::move(file);
+}
+
+void DecisionTree::set_leaf_distributions(vector<float> dist, int leaves, int classes) {
+    leaf_dist = std::move(dist);
+    leaf_dist_view = leaf_dist.empty() ? nullptr : leaf_dist.data();
+    n_leaves = leaves;
+    leaf_classes = classes;
+}
+
+void DecisionTree::attach_leaf_distributions(const float* dist, int leaves, int classes) {
+    leaf_dist.clear();
+    leaf_dist.shrink_to_fit();
+    leaf_dist_view = dist;
+    n_leaves = leaves;
+    leaf_classes = classes;
+}
+
+int DecisionTree::predict(const vector<double>& row) const {
+    // Iterative walk, no recursion and no pointer chasing
+    const FlatNode* flat = node_view;
+    int i = 0;
+    while (flat[i].feature >= 0) {
+        const FlatNode& n = flat[i];
+        i = n.child + !(row[n.feature] < n.threshold);
+    }
+    return flat[i].child;
+}
+
+// The vector kernels compute feature * n_rows + row in 32-bit lanes: larger
+// datasets take the scalar walk, which indexes with size_t
+static SimdKernel kernel_for(const Dataset& data, SimdKernel kernel) {
+    return (size_t)data.rows * data.cols >= (size_t(1) << 31) ? SimdKernel::Scalar : kernel;
+}
+
+void DecisionTree::predict_rows(const Dataset& data, int row_begin, int row_end, int* out,
+                                SimdKernel kernel) const {
+    kernel = kernel_for(data, kernel);
+    data.with_features([&](auto features) {
+        switch (kernel) {
+            case SimdKernel::AVX512: predict_rows_avx512(node_view, flat_depth, features, data.rows, row_begin, row_end, out); break;
+            case SimdKernel::AVX2: predict_rows_avx2(node_view, flat_depth, features, data.rows, row_begin, row_end, out); break;
+            default: predict_rows_scalar(node_view, flat_depth, features, data.rows, row_begin, row_end, out); break;
+        }
+    });
+}
+
+void DecisionTree::predict_leaves(const Dataset& data, int row_begin, int row_end, int* out,
+                                  SimdKernel kernel) const {
+    kernel = kernel_for(data, kernel);
+    data.with_features([&](auto features) {
+        switch (kernel) {
+            case SimdKernel::AVX512: predict_rows_avx512(node_view, flat_depth, features, data.rows, row_begin, row_end, out, LeafValue::Index); break;
+            case SimdKernel::AVX2: predict_rows_avx2(node_view, flat_depth, features, data.rows, row_begin, row_end, out, LeafValue::Index); break;
+            default: predict_rows_scalar(node_view, flat_depth, features, data.rows, row_begin, row_end, out, LeafValue::Index); break;
+        }
+    });
+}
\ No newline at end of file
@@ -0,0 +1,220 @@
+#include "TreeSimd.h"
+#include "Tree.h"
+#include <immintrin.h>
+
+// Every kernel is compiled for its own instruction set through the target
+// attribute, so the binary runs anywhere and picks the widest one at runtime.
+// A lane that reached a leaf keeps its index while the others keep walking,
+// and the walk always takes 'depth' steps: no data-dependent branches.
+
+static_assert(sizeof(FlatNode) == 16, "the gathers assume 16-byte nodes");
+
+SimdKernel best_simd_kernel() {
+    static const SimdKernel kernel = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")) return SimdKernel::AVX512;
+        if (__builtin_cpu_supports("avx2")) return SimdKernel::AVX2;
+        return SimdKernel::Scalar;
+    }();
+    return kernel;
+}
+
+const char* simd_kernel_name(SimdKernel kernel) {
+    switch (kernel) {
+        case SimdKernel::AVX512: return "avx512";
+        case SimdKernel::AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+// LEAF_INDEX: write the leaf index (~feature of the leaf) instead of its label
+template <bool LEAF_INDEX, typename T>
+static void walk_scalar(const FlatNode* nodes, const T* features, size_t n_rows,
+                        int row_begin, int row_end, int* out) {
+    for (int r = row_begin; r < row_end; r++) {
+        int i = 0;
+        while (nodes[i].feature >= 0) {
+            const FlatNode& n = nodes[i];
+            i = n.child + !(features[n.feature * n_rows + r] < n.threshold);
+        }
+        out[r - row_begin] = LEAF_INDEX ? ~nodes[i].feature : nodes[i].child;
+    }
+}
+
+// Rows walked together by the vector kernels: several independent groups keep
+// enough gathers in flight to hide their latency
+static constexpr int GROUPS = 4;
+
+// AVX2: feature values of the lanes, widened to double for the compare
+__attribute__((target("avx2")))
+static inline __m256d gather_values_avx2(const double* features, __m128i offset) {
+    const __m256d all_d = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), features, offset, all_d, 8);
+}
+__attribute__((target("avx2")))
+static inline __m256d gather_values_avx2(const float* features, __m128i offset) {
+    const __m128 all_s = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    return _mm256_cvtps_pd(_mm_mask_i32gather_ps(_mm_setzero_ps(), features, offset, all_s, 4));
+}
+// AVX-512: lanes going right, !(value < threshold). Float values are compared
+// with the threshold rounded up to a float: for a float x, x < t exactly when
+// x < round_up(t), and the rounding is off the gather chain of the values.
+__attribute__((target("avx512f,avx512vl")))
+static inline __mmask8 goes_right_avx512(const double* features, __mmask8 active, __m256i offset,
+                                         __m512d threshold) {
+    __m512d value = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), active, offset, features, 8);
+    return _mm512_cmp_pd_mask(value, threshold, _CMP_NLT_UQ);
+}
+__attribute__((target("avx512f,avx512vl")))
+static inline __mmask8 goes_right_avx512(const float* features, __mmask8 active, __m256i offset,
+                                         __m512d threshold) {
+    __m256 threshold32 = _mm512_maskz_cvt_roundpd_ps(active, threshold, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC);
+    __m256 value = _mm256_mmask_i32gather_ps(_mm256_setzero_ps(), active, offset, features, 4);
+    return _mm256_cmp_ps_mask(value, threshold32, _CMP_NLT_UQ);
+}
+
+template <bool LEAF_INDEX, typename T>
+__attribute__((target("avx2")))
+static void walk_avx2(const FlatNode* nodes, int depth, const T* features, size_t n_rows,
+                      int row_begin, int row_end, int* out) {
+    // Node fields seen as int32 (feature, child) and double (threshold) arrays:
+    // node i has feature at int 4i, child at int 4i+1, threshold at double 2i+1
+    const int* node_ints = reinterpret_cast<const int*>(nodes);
+    const double* node_thresholds = reinterpret_cast<const double*>(nodes) + 1;
+    const __m128i n_rows_v = _mm_set1_epi32((int)n_rows);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i all_i = _mm_set1_epi32(-1);
+    const __m256d all_d = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    // Picks the low 32 bits of the four 64-bit compare results
+    const __m256i pack_lo = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    const int step = 4 * GROUPS;
+
+    int r = row_begin;
+    for (; r + step <= row_end; r += step) {
+        __m128i rows[GROUPS], idx[GROUPS];
+        for (int g = 0; g < GROUPS; g++) {
+            rows[g] = _mm_add_epi32(_mm_set1_epi32(r + 4 * g), _mm_setr_epi32(0, 1, 2, 3));
+            idx[g] = zero;
+        }
+
+        // Every root-to-leaf path is at most 'depth' steps long; lanes already on a leaf stay there
+        for (int d = 0; d < depth; d++) {
+            for (int g = 0; g < GROUPS; g++) {
+                __m128i off = _mm_slli_epi32(idx[g], 2);
+                __m128i feature = _mm_mask_i32gather_epi32(zero, node_ints, off, all_i, 4);
+                __m128i child = _mm_mask_i32gather_epi32(zero, node_ints + 1, off, all_i, 4);
+                __m256d threshold = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), node_thresholds,
+                                                             _mm_slli_epi32(idx[g], 1), all_d, 8);
+                __m128i leaf = _mm_cmplt_epi32(feature, zero);
+
+                // Leaves read feature 0 of their row: always in bounds, result discarded
+                __m128i offset = _mm_add_epi32(_mm_mullo_epi32(_mm_max_epi32(feature, zero), n_rows_v), rows[g]);
+                __m256d value = gather_values_avx2(features, offset);
+
+                // Not (value < threshold), as in the scalar walk: NaN goes right
+                __m256d right = _mm256_cmp_pd(value, threshold, _CMP_NLT_UQ);
+                __m128i right32 = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(right), pack_lo));
+
+                // right32 is -1 where we go right: next = child + 1
+                __m128i next = _mm_sub_epi32(child, right32);
+                idx[g] = _mm_blendv_epi8(next, idx[g], leaf);
+            }
+        }
+
+        for (int g = 0; g < GROUPS; g++) {
+            __m128i value;
+            if (LEAF_INDEX) {
+                value = _mm_mask_i32gather_epi32(zero, node_ints, _mm_slli_epi32(idx[g], 2), all_i, 4);
+                value = _mm_xor_si128(value, all_i);
+            } else {
+                value = _mm_mask_i32gather_epi32(zero, node_ints + 1, _mm_slli_epi32(idx[g], 2), all_i, 4);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + (r + 4 * g - row_begin)), value);
+        }
+    }
+
+    // Tail rows
+    if (r < row_end) walk_scalar<LEAF_INDEX>(nodes, features, n_rows, r, row_end, out + (r - row_begin));
+}
+
+template <bool LEAF_INDEX, typename T>
+__attribute__((target("avx512f,avx512vl")))
+static void walk_avx512(const FlatNode* nodes, int depth, const T* features, size_t n_rows,
+                        int row_begin, int row_end, int* out) {
+    const int* node_ints = reinterpret_cast<const int*>(nodes);
+    const double* node_thresholds = reinterpret_cast<const double*>(nodes) + 1;
+    const __m256i n_rows_v = _mm256_set1_epi32((int)n_rows);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const int step = 8 * GROUPS;
+
+    int r = row_begin;
+    for (; r + step <= row_end; r += step) {
+        __m256i rows[GROUPS], idx[GROUPS];
+        for (int g = 0; g < GROUPS; g++) {
+            rows[g] = _mm256_add_epi32(_mm256_set1_epi32(r + 8 * g), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+            idx[g] = zero;
+        }
+
+        for (int d = 0; d < depth; d++) {
+            for (int g = 0; g < GROUPS; g++) {
+                __m256i off = _mm256_slli_epi32(idx[g], 2);
+                __m256i feature = _mm256_mmask_i32gather_epi32(zero, 0xFF, off, node_ints, 4);
+                __mmask8 active = _mm256_cmpge_epi32_mask(feature, zero);
+
+                __m256i child = _mm256_mmask_i32gather_epi32(zero, active, off, node_ints + 1, 4);
+                __m512d threshold = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), active,
+                                                             _mm256_slli_epi32(idx[g], 1), node_thresholds, 8);
+
+                __m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(feature, n_rows_v), rows[g]);
+                __mmask8 right = goes_right_avx512(features, active, offset, threshold);
+                __m256i next = _mm256_mask_add_epi32(child, right, child, one);
+                idx[g] = _mm256_mask_mov_epi32(idx[g], active, next);
+            }
+        }
+
+        for (int g = 0; g < GROUPS; g++) {
+            __m256i value;
+            if (LEAF_INDEX) {
+                value = _mm256_mmask_i32gather_epi32(zero, 0xFF, _mm256_slli_epi32(idx[g], 2), node_ints, 4);
+                value = _mm256_xor_si256(value, _mm256_set1_epi32(-1));
+            } else {
+                value = _mm256_mmask_i32gather_epi32(zero, 0xFF, _mm256_slli_epi32(idx[g], 2), node_ints + 1, 4);
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + (r + 8 * g - row_begin)), value);
+        }
+    }
+
+    if (r < row_end) walk_scalar<LEAF_INDEX>(nodes, features, n_rows, r, row_end, out + (r - row_begin));
+}
+
+void predict_rows_scalar(const FlatNode* nodes, int, const double* features, size_t n_rows,
+                         int row_begin, int row_end, int* out, LeafValue value) {
+    if (value == LeafValue::Index) walk_scalar<true>(nodes, features, n_rows, row_begin, row_end, out);
+    else walk_scalar<false>(nodes, features, n_rows, row_begin, row_end, out);
+}
+void predict_rows_scalar(const FlatNode* nodes, int, const float* features, size_t n_rows,
+                         int row_begin, int row_end, int* out, LeafValue value) {
+    if (value == LeafValue::Index) walk_scalar<true>(nodes, features, n_rows, row_begin, row_end, out);
+    else walk_scalar<false>(nodes, features, n_rows, row_begin, row_end, out);
+}
+void predict_rows_avx2(const FlatNode* nodes, int depth, const double* features, size_t n_rows,
+                       int row_begin, int row_end, int* out, LeafValue value) {
+    if (value == LeafValue::Index) walk_avx2<true>(nodes, depth, features, n_rows, row_begin, row_end, out);
+    else walk_avx2<false>(nodes, depth, features, n_rows, row_begin, row_end, out);
+}
+void predict_rows_avx2(const FlatNode* nodes, int depth, const float* features, size_t n_rows,
+                       int row_begin, int row_end, int* out, LeafValue value) {
+    if (value == LeafValue::Index) walk_avx2<true>(nodes, depth, features, n_rows, row_begin, row_end, out);
+    else walk_avx2<false>(nodes, depth, features, n_rows, row_begin, row_end, out);
+}
+void predict_rows_avx512(const FlatNode* nodes, int depth, const double* features, size_t n_rows,
+                         int row_begin, int row_end, int* out, LeafValue value) {
+    if (value == LeafValue::Index) walk_avx512<true>(nodes, depth, features, n_rows, row_begin, row_end, out);
+    else walk_avx512<false>(nodes, depth, features, n_rows, row_begin, row_end, out);
+}
+void predict_rows_avx512(const FlatNode* nodes, int depth, const float* features, size_t n_rows,
+                         int row_begin, int row_end, int* out, LeafValue value) {
+    if (value == LeafValue::Index) walk_avx512<true>(nodes, depth, features, n_rows, row_begin, row_end, out);
+    else walk_avx512<false>(nodes, depth, features, n_rows, row_begin, row_end, out);
+}
\ No newline at end of file